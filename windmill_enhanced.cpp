@@ -15,33 +15,70 @@
  * 
  * OOP CONCEPTS DEMONSTRATED:
  * 1. Encapsulation - Private members
- * 2. Inheritance - Base Drawable class
- * 3. Polymorphism - Virtual functions
+ * 2. Inheritance - Render backends share one base class
+ * 3. Polymorphism - Virtual functions and templated entity kinds
  * 4. Abstraction - Abstract base class
- * 5. Composition - Scene contains objects
+ * 5. Composition - Scene holds a World of component archetypes
  * 6. Constructor/Destructor
  * 7. Static members
  * 
  * CONTROLS:
- * - '1', '2', '3' : Select windmill (1st, 2nd, 3rd)
+ * - '1' ... '5' : Select the windmill with that number
  * - '+' / '=' : Increase selected windmill speed
- * - '-' : Decrease selected windmill speed
+ * - '-' / '_' : Decrease selected windmill speed
  * - 'd' : Day mode
  * - 'n' : Night mode
  * - 'c' : Add new cloud
  * - 'w' : Add new windmill
+ * - 'x' : Remove selected windmill
  * - 's' : Toggle sun/moon animation
  * - 'p' : Pause/Resume all
+ * - '[' / ']' : Slower/faster simulated time (x1 to x10000)
+ * - 'o' : Save the scene snapshot
+ * - 'l' : Load the scene snapshot
  * - 'r' : Reset simulation
  * - 'q' / ESC : Exit
  */
 
 #include <GL/freeglut.h>
+#include <GL/glext.h>
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define SNAPSHOT_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <new>
+#include <type_traits>
+#include <random>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -51,10 +88,27 @@ using namespace std;
 const int WINDOW_WIDTH = 1000;
 const int WINDOW_HEIGHT = 700;
 
+// World-space extent of the orthographic view
+const float WORLD_WIDTH = 1000.0f;
+const float WORLD_HEIGHT = 700.0f;
+
+// Seconds of simulated time per fixed step
+constexpr double SIMULATION_STEP = 1.0 / 60.0;
+
+const float SELECTION_RADIUS = 100.0f;
+
+// Current framebuffer size, kept up to date by reshape()
+int viewportWidth = WINDOW_WIDTH;
+int viewportHeight = WINDOW_HEIGHT;
+
 // Mode settings
 bool isDay = true;
 bool isPaused = false;
 bool animateCelestial = true;
+float windSpeed = 10.0f;    // Ambient wind in m/s (--wind)
+uint32_t randomSeed = static_cast<uint32_t>(time(nullptr));  // Everything random in a run (--seed)
+bool headlessMode = false;  // Offscreen rendering without GLUT (--headless)
+string snapshotPath = "windmill.snapshot";  // Written by O, read by L (--save, --load)
 
 // Colors
 struct Color {
@@ -65,488 +119,5976 @@ struct Color {
 
 
 /**
- * @class Drawable
- * @brief Abstract base class for all drawable objects
+ * @struct Rect
+ * @brief Axis-aligned box in world coordinates; empty when x1 < x0
+ */
+struct Rect {
+    float x0, y0, x1, y1;
+    
+    Rect() : x0(0), y0(0), x1(-1), y1(-1) {}
+    Rect(float left, float bottom, float right, float top)
+        : x0(left), y0(bottom), x1(right), y1(top) {}
+    
+    bool isEmpty() const { return x1 < x0 || y1 < y0; }
+    
+    bool overlaps(const Rect& o) const {
+        return !isEmpty() && !o.isEmpty()
+            && x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+    }
+    
+    void include(const Rect& o) {
+        if(o.isEmpty()) return;
+        if(isEmpty()) {
+            *this = o;
+            return;
+        }
+        x0 = min(x0, o.x0);
+        y0 = min(y0, o.y0);
+        x1 = max(x1, o.x1);
+        y1 = max(y1, o.y1);
+    }
+};
+
+/**
+ * @struct PixelRect
+ * @brief Framebuffer rectangle, origin at the bottom-left like glScissor
+ */
+struct PixelRect {
+    int x, y, width, height;
+};
+
+
+/**
+ * @class DamageRegion
+ * @brief Screen areas that must be redrawn before the next present
+ *
+ * Objects report the box they covered last frame and the one they cover
+ * now. Touching boxes are merged, and past MAX_RECTS the pair whose union
+ * adds the least area is merged, since each box costs a redraw pass.
  */
-class Drawable {
-protected:
-    float x, y;          // Position 
-    bool visible;        // Visibility state
+class DamageRegion {
+private:
+    static const size_t MAX_RECTS = 8;
+    static const int PAD = 3;  // Pixels for antialiased and 3 px wide lines
+    
+    vector<Rect> rects;
+    bool full;
+
+public:
+    DamageRegion() : full(true) {}  // Nothing has been drawn yet
+    
+    void markFull() {
+        full = true;
+        rects.clear();
+    }
+    
+    void add(const Rect& r) {
+        if(full || r.isEmpty()) return;
+        absorb(r);
+        
+        while(rects.size() > MAX_RECTS) {
+            size_t bestI = 0, bestJ = 1;
+            float bestCost = 0.0f;
+            for(size_t i = 0; i < rects.size(); i++) {
+                for(size_t j = i + 1; j < rects.size(); j++) {
+                    Rect u = rects[i];
+                    u.include(rects[j]);
+                    float cost = area(u) - area(rects[i]) - area(rects[j]);
+                    if((i == 0 && j == 1) || cost < bestCost) {
+                        bestCost = cost;
+                        bestI = i;
+                        bestJ = j;
+                    }
+                }
+            }
+            Rect merged = rects[bestI];
+            merged.include(rects[bestJ]);
+            rects.erase(rects.begin() + bestJ);
+            rects.erase(rects.begin() + bestI);
+            absorb(merged);
+        }
+    }
+    
+    bool isEmpty() const { return !full && rects.empty(); }
+    bool isFull() const { return full; }
+    
+    void clear() {
+        full = false;
+        rects.clear();
+    }
+    
+    // Padded pixel rectangles to redraw, clipped to the framebuffer
+    vector<PixelRect> toPixels(int width, int height) const {
+        vector<PixelRect> out;
+        if(full) {
+            out.push_back({0, 0, width, height});
+            return out;
+        }
+        for(const Rect& r : rects) {
+            int px0 = max(0, static_cast<int>(floorf((r.x0 + WORLD_WIDTH / 2) * width / WORLD_WIDTH)) - PAD);
+            int py0 = max(0, static_cast<int>(floorf((r.y0 + WORLD_HEIGHT / 2) * height / WORLD_HEIGHT)) - PAD);
+            int px1 = min(width, static_cast<int>(ceilf((r.x1 + WORLD_WIDTH / 2) * width / WORLD_WIDTH)) + PAD);
+            int py1 = min(height, static_cast<int>(ceilf((r.y1 + WORLD_HEIGHT / 2) * height / WORLD_HEIGHT)) + PAD);
+            if(px1 > px0 && py1 > py0) out.push_back({px0, py0, px1 - px0, py1 - py0});
+        }
+        return out;
+    }
+    
+private:
+    static float area(const Rect& r) { return (r.x1 - r.x0) * (r.y1 - r.y0); }
+    
+    // Adds r, first swallowing every rectangle it touches as it grows
+    void absorb(Rect r) {
+        for(size_t i = 0; i < rects.size();) {
+            if(rects[i].overlaps(r)) {
+                r.include(rects[i]);
+                rects[i] = rects.back();
+                rects.pop_back();
+                i = 0;
+            } else {
+                i++;
+            }
+        }
+        rects.push_back(r);
+    }
     
 public:
-    // Constructor
-    Drawable(float posX = 0.0f, float posY = 0.0f) 
-        : x(posX), y(posY), visible(true) {}
+    // World-space box covered by a pixel rectangle, for culling a pass
+    static Rect toWorld(const PixelRect& p, int width, int height) {
+        return Rect(p.x * WORLD_WIDTH / width - WORLD_WIDTH / 2,
+                    p.y * WORLD_HEIGHT / height - WORLD_HEIGHT / 2,
+                    (p.x + p.width) * WORLD_WIDTH / width - WORLD_WIDTH / 2,
+                    (p.y + p.height) * WORLD_HEIGHT / height - WORLD_HEIGHT / 2);
+    }
+};
+
+// Everything that changed since the last present
+DamageRegion damage;
+
+
+/**
+ * @struct GLExtensions
+ * @brief Post-1.1 entry points, resolved once at startup
+ *
+ * opengl32 on Windows only exports GL 1.1, so anything newer has to be
+ * looked up at runtime. Every feature has a fallback when lookup fails.
+ */
+struct GLExtensions {
+    // Buffer objects (GL 1.5)
+    PFNGLGENBUFFERSPROC genBuffers = nullptr;
+    PFNGLDELETEBUFFERSPROC deleteBuffers = nullptr;
+    PFNGLBINDBUFFERPROC bindBuffer = nullptr;
+    PFNGLBUFFERDATAPROC bufferData = nullptr;
+    
+    // Persistently mapped buffers (GL 4.4 or ARB_buffer_storage, with GL 3.2 sync)
+    PFNGLBUFFERSTORAGEPROC bufferStorage = nullptr;
+    PFNGLMAPBUFFERRANGEPROC mapBufferRange = nullptr;
+    PFNGLUNMAPBUFFERPROC unmapBuffer = nullptr;
+    PFNGLFENCESYNCPROC fenceSync = nullptr;
+    PFNGLCLIENTWAITSYNCPROC clientWaitSync = nullptr;
+    PFNGLDELETESYNCPROC deleteSync = nullptr;
+    
+    // Shaders (GL 2.0)
+    PFNGLCREATESHADERPROC createShader = nullptr;
+    PFNGLSHADERSOURCEPROC shaderSource = nullptr;
+    PFNGLCOMPILESHADERPROC compileShader = nullptr;
+    PFNGLGETSHADERIVPROC getShaderiv = nullptr;
+    PFNGLGETSHADERINFOLOGPROC getShaderInfoLog = nullptr;
+    PFNGLDELETESHADERPROC deleteShader = nullptr;
+    PFNGLCREATEPROGRAMPROC createProgram = nullptr;
+    PFNGLATTACHSHADERPROC attachShader = nullptr;
+    PFNGLBINDATTRIBLOCATIONPROC bindAttribLocation = nullptr;
+    PFNGLLINKPROGRAMPROC linkProgram = nullptr;
+    PFNGLGETPROGRAMIVPROC getProgramiv = nullptr;
+    PFNGLGETPROGRAMINFOLOGPROC getProgramInfoLog = nullptr;
+    PFNGLUSEPROGRAMPROC useProgram = nullptr;
+    PFNGLGETUNIFORMLOCATIONPROC getUniformLocation = nullptr;
+    PFNGLUNIFORM1FPROC uniform1f = nullptr;
+    PFNGLUNIFORM2FPROC uniform2f = nullptr;
+    PFNGLVERTEXATTRIBPOINTERPROC vertexAttribPointer = nullptr;
+    PFNGLENABLEVERTEXATTRIBARRAYPROC enableVertexAttribArray = nullptr;
+    PFNGLDISABLEVERTEXATTRIBARRAYPROC disableVertexAttribArray = nullptr;
+    
+    // Instancing (GL 3.3 or ARB_instanced_arrays + ARB_draw_instanced)
+    PFNGLVERTEXATTRIBDIVISORPROC vertexAttribDivisor = nullptr;
+    PFNGLDRAWARRAYSINSTANCEDPROC drawArraysInstanced = nullptr;
     
-    // Virtual destructor
-    virtual ~Drawable() {}
+    // Framebuffer objects (GL 3.0 or ARB_framebuffer_object)
+    PFNGLGENFRAMEBUFFERSPROC genFramebuffers = nullptr;
+    PFNGLDELETEFRAMEBUFFERSPROC deleteFramebuffers = nullptr;
+    PFNGLBINDFRAMEBUFFERPROC bindFramebuffer = nullptr;
+    PFNGLGENRENDERBUFFERSPROC genRenderbuffers = nullptr;
+    PFNGLDELETERENDERBUFFERSPROC deleteRenderbuffers = nullptr;
+    PFNGLBINDRENDERBUFFERPROC bindRenderbuffer = nullptr;
+    PFNGLRENDERBUFFERSTORAGEPROC renderbufferStorage = nullptr;
+    PFNGLFRAMEBUFFERRENDERBUFFERPROC framebufferRenderbuffer = nullptr;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC checkFramebufferStatus = nullptr;
+    PFNGLBLITFRAMEBUFFERPROC blitFramebuffer = nullptr;
     
-    // Pure virtual functions
-    virtual void draw() = 0;
-    virtual void update() = 0;
+    bool hasBuffers() const {
+        return genBuffers && deleteBuffers && bindBuffer && bufferData;
+    }
+    
+    bool hasPersistentMapping() const {
+        return hasBuffers() && bufferStorage && mapBufferRange && unmapBuffer
+            && fenceSync && clientWaitSync && deleteSync;
+    }
+    
+    bool hasShaders() const {
+        return createShader && shaderSource && compileShader && getShaderiv
+            && getShaderInfoLog && deleteShader && createProgram && attachShader
+            && bindAttribLocation && linkProgram && getProgramiv && getProgramInfoLog
+            && useProgram && getUniformLocation && uniform1f && uniform2f
+            && vertexAttribPointer && enableVertexAttribArray && disableVertexAttribArray;
+    }
+    
+    bool hasInstancing() const {
+        return hasBuffers() && hasShaders() && vertexAttribDivisor && drawArraysInstanced;
+    }
     
-    // Getters and setters
-    float getX() const { return x; }
-    float getY() const { return y; }
-    void setPosition(float newX, float newY) { x = newX; y = newY; }
-    bool isVisible() const { return visible; }
-    void setVisible(bool v) { visible = v; }
+    bool hasFramebuffers() const {
+        return genFramebuffers && deleteFramebuffers && bindFramebuffer && genRenderbuffers
+            && deleteRenderbuffers && bindRenderbuffer && renderbufferStorage
+            && framebufferRenderbuffer && checkFramebufferStatus && blitFramebuffer;
+    }
 };
 
+GLExtensions glExt;
 
-void drawCircle(float cx, float cy, float radius, int segments = 100) {
-    glBegin(GL_POLYGON);
-    for(int i = 0; i < segments; i++) {
-        float theta = 2.0f * 3.14159f * float(i) / float(segments);
-        float x = radius * cosf(theta);
-        float y = radius * sinf(theta);
-        glVertex2f(x + cx, y + cy);
+typedef void (*GLProc)();
+typedef GLProc (*GLProcLoader)(const char*);
+
+bool glVersionAtLeast(int major, int minor) {
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    int maj = 0, min = 0;
+    if(!version || sscanf(version, "%d.%d", &maj, &min) != 2) return false;
+    return maj > major || (maj == major && min >= minor);
+}
+
+bool hasGLExtension(const char* name) {
+    const char* list = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    if(!list) return false;
+    size_t len = strlen(name);
+    for(const char* p = strstr(list, name); p; p = strstr(p + len, name)) {
+        if((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
     }
-    glEnd();
+    return false;
 }
 
-float randomFloat(float min, float max) {
-    return min + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (max - min)));
+// Needs a current context; some loaders hand out pointers for anything, so
+// the version string decides what is actually supported
+void loadGLExtensions(GLProcLoader getProc) {
+    if(glVersionAtLeast(1, 5)) {
+        glExt.genBuffers = (PFNGLGENBUFFERSPROC)getProc("glGenBuffers");
+        glExt.deleteBuffers = (PFNGLDELETEBUFFERSPROC)getProc("glDeleteBuffers");
+        glExt.bindBuffer = (PFNGLBINDBUFFERPROC)getProc("glBindBuffer");
+        glExt.bufferData = (PFNGLBUFFERDATAPROC)getProc("glBufferData");
+    }
+    
+    bool hasSync = glVersionAtLeast(3, 2) || hasGLExtension("GL_ARB_sync");
+    bool hasStorage = glVersionAtLeast(4, 4) || hasGLExtension("GL_ARB_buffer_storage");
+    if(glExt.hasBuffers() && hasSync && hasStorage) {
+        glExt.bufferStorage = (PFNGLBUFFERSTORAGEPROC)getProc("glBufferStorage");
+        glExt.mapBufferRange = (PFNGLMAPBUFFERRANGEPROC)getProc("glMapBufferRange");
+        glExt.unmapBuffer = (PFNGLUNMAPBUFFERPROC)getProc("glUnmapBuffer");
+        glExt.fenceSync = (PFNGLFENCESYNCPROC)getProc("glFenceSync");
+        glExt.clientWaitSync = (PFNGLCLIENTWAITSYNCPROC)getProc("glClientWaitSync");
+        glExt.deleteSync = (PFNGLDELETESYNCPROC)getProc("glDeleteSync");
+    }
+    
+    if(glVersionAtLeast(2, 0)) {
+        glExt.createShader = (PFNGLCREATESHADERPROC)getProc("glCreateShader");
+        glExt.shaderSource = (PFNGLSHADERSOURCEPROC)getProc("glShaderSource");
+        glExt.compileShader = (PFNGLCOMPILESHADERPROC)getProc("glCompileShader");
+        glExt.getShaderiv = (PFNGLGETSHADERIVPROC)getProc("glGetShaderiv");
+        glExt.getShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)getProc("glGetShaderInfoLog");
+        glExt.deleteShader = (PFNGLDELETESHADERPROC)getProc("glDeleteShader");
+        glExt.createProgram = (PFNGLCREATEPROGRAMPROC)getProc("glCreateProgram");
+        glExt.attachShader = (PFNGLATTACHSHADERPROC)getProc("glAttachShader");
+        glExt.bindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)getProc("glBindAttribLocation");
+        glExt.linkProgram = (PFNGLLINKPROGRAMPROC)getProc("glLinkProgram");
+        glExt.getProgramiv = (PFNGLGETPROGRAMIVPROC)getProc("glGetProgramiv");
+        glExt.getProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)getProc("glGetProgramInfoLog");
+        glExt.useProgram = (PFNGLUSEPROGRAMPROC)getProc("glUseProgram");
+        glExt.getUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)getProc("glGetUniformLocation");
+        glExt.uniform1f = (PFNGLUNIFORM1FPROC)getProc("glUniform1f");
+        glExt.uniform2f = (PFNGLUNIFORM2FPROC)getProc("glUniform2f");
+        glExt.vertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)getProc("glVertexAttribPointer");
+        glExt.enableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)getProc("glEnableVertexAttribArray");
+        glExt.disableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)getProc("glDisableVertexAttribArray");
+    }
+    
+    if(glVersionAtLeast(3, 3)) {
+        glExt.vertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)getProc("glVertexAttribDivisor");
+        glExt.drawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDPROC)getProc("glDrawArraysInstanced");
+    } else if(hasGLExtension("GL_ARB_instanced_arrays") && hasGLExtension("GL_ARB_draw_instanced")) {
+        glExt.vertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)getProc("glVertexAttribDivisorARB");
+        glExt.drawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDPROC)getProc("glDrawArraysInstancedARB");
+    }
+    
+    // The ARB extension uses the core names
+    if(glVersionAtLeast(3, 0) || hasGLExtension("GL_ARB_framebuffer_object")) {
+        glExt.genFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)getProc("glGenFramebuffers");
+        glExt.deleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)getProc("glDeleteFramebuffers");
+        glExt.bindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)getProc("glBindFramebuffer");
+        glExt.genRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)getProc("glGenRenderbuffers");
+        glExt.deleteRenderbuffers = (PFNGLDELETERENDERBUFFERSPROC)getProc("glDeleteRenderbuffers");
+        glExt.bindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)getProc("glBindRenderbuffer");
+        glExt.renderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)getProc("glRenderbufferStorage");
+        glExt.framebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)getProc("glFramebufferRenderbuffer");
+        glExt.checkFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)getProc("glCheckFramebufferStatus");
+        glExt.blitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)getProc("glBlitFramebuffer");
+    }
 }
 
 
+/**
+ * @struct ColorVertex
+ * @brief Interleaved 2D position and colour used by every cached mesh
+ */
+struct ColorVertex {
+    float x, y;
+    float r, g, b;
+};
+
 
 /**
- * @class Cloud
- * @brief Moving cloud with animation
+ * @class Mesh
+ * @brief Geometry triangulated once and kept in a vertex buffer
+ *
+ * Fills are stored as GL_TRIANGLES and outlines as GL_LINES so that any
+ * number of shapes can share one draw call.
+ */
+class Mesh {
+private:
+    vector<ColorVertex> vertices;
+    GLenum primitive;
+    GLuint vbo;
+    
+public:
+    explicit Mesh(GLenum prim = GL_TRIANGLES) : primitive(prim), vbo(0) {}
+    
+    ~Mesh() {
+        if(vbo && glExt.hasBuffers()) glExt.deleteBuffers(1, &vbo);
+    }
+    
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    
+    // Convex polygon, triangulated as a fan around its first point
+    void addPolygon(const vector<float>& points, Color col) {
+        size_t count = points.size() / 2;
+        for(size_t i = 1; i + 1 < count; i++) {
+            addVertex(points[0], points[1], col);
+            addVertex(points[2 * i], points[2 * i + 1], col);
+            addVertex(points[2 * i + 2], points[2 * i + 3], col);
+        }
+    }
+    
+    // Closed outline, expanded into independent line segments
+    void addLineLoop(const vector<float>& points, Color col) {
+        size_t count = points.size() / 2;
+        for(size_t i = 0; i < count; i++) {
+            size_t next = (i + 1) % count;
+            addVertex(points[2 * i], points[2 * i + 1], col);
+            addVertex(points[2 * next], points[2 * next + 1], col);
+        }
+    }
+    
+    void addVertex(float px, float py, Color col) {
+        vertices.push_back({px, py, col.r, col.g, col.b});
+    }
+    
+    void clear() { vertices.clear(); }
+    
+    // Copy the vertices to GPU memory; without buffer objects they stay client-side
+    void upload() {
+        if(!glExt.hasBuffers() || vertices.empty()) return;
+        if(!vbo) glExt.genBuffers(1, &vbo);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glExt.bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(ColorVertex),
+                         vertices.data(), GL_STATIC_DRAW);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    void draw() const {
+        if(vertices.empty()) return;
+        
+        const char* base = reinterpret_cast<const char*>(vertices.data());
+        if(vbo) {
+            glExt.bindBuffer(GL_ARRAY_BUFFER, vbo);
+            base = nullptr;
+        }
+        
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(ColorVertex), base);
+        glColorPointer(3, GL_FLOAT, sizeof(ColorVertex), base + 2 * sizeof(float));
+        glDrawArrays(primitive, 0, static_cast<GLsizei>(vertices.size()));
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        
+        if(vbo) glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    const vector<ColorVertex>& getVertices() const { return vertices; }
+    GLenum getPrimitive() const { return primitive; }
+    GLuint getBuffer() const { return vbo; }
+    GLsizei size() const { return static_cast<GLsizei>(vertices.size()); }
+};
+
+
+/**
+ * @class CircleLibrary
+ * @brief Unit circle tables and level-of-detail selection for round shapes
+ *
+ * Every circle, arc and ring is built from a precomputed cos/sin table, so
+ * no trig runs per vertex. The segment count is chosen from the radius in
+ * screen pixels: just enough that the polygon never strays more than a
+ * third of a pixel from the true circle. Shapes are appended to any sink
+ * with addVertex(x, y, colour), such as a Mesh or the RenderQueue.
+ */
+class CircleLibrary {
+private:
+    static vector<vector<float>> unitTables;   // Indexed by segment count
+    static float pixelsPerUnit;
+    
+public:
+    static const int MIN_SEGMENTS = 8;
+    static const int MAX_SEGMENTS = 256;
+    
+    // World units to pixels for the current viewport
+    static void setPixelScale(float scale) { pixelsPerUnit = scale; }
+    static float getPixelScale() { return pixelsPerUnit; }
+    
+    static int segmentsFor(float radius) {
+        const float maxError = 0.35f;  // Pixels between chord and arc
+        float pixels = radius * pixelsPerUnit;
+        int segments = MIN_SEGMENTS;
+        if(pixels > maxError) {
+            float needed = 3.14159f / acosf(1.0f - maxError / pixels);
+            while(segments < needed && segments < MAX_SEGMENTS) segments *= 2;
+        }
+        return segments;
+    }
+    
+    // Interleaved cos/sin for 'segments' points around the unit circle
+    static const float* unitCircle(int segments) {
+        if(segments >= static_cast<int>(unitTables.size())) unitTables.resize(segments + 1);
+        vector<float>& table = unitTables[segments];
+        if(table.empty()) {
+            table.resize(segments * 2);
+            for(int i = 0; i < segments; i++) {
+                float theta = 2.0f * 3.14159f * float(i) / float(segments);
+                table[2 * i] = cosf(theta);
+                table[2 * i + 1] = sinf(theta);
+            }
+        }
+        return table.data();
+    }
+    
+    // Filled circle as a triangle fan around the centre
+    template<class Sink>
+    static void appendDisc(Sink& mesh, float cx, float cy, float radius, Color col, int segments = 0) {
+        if(segments <= 0) segments = segmentsFor(radius);
+        const float* unit = unitCircle(segments);
+        for(int i = 0; i < segments; i++) {
+            int next = (i + 1) % segments;
+            mesh.addVertex(cx, cy, col);
+            mesh.addVertex(cx + radius * unit[2 * i], cy + radius * unit[2 * i + 1], col);
+            mesh.addVertex(cx + radius * unit[2 * next], cy + radius * unit[2 * next + 1], col);
+        }
+    }
+    
+    // Circle outline as line segments
+    template<class Sink>
+    static void appendRing(Sink& mesh, float cx, float cy, float radius, Color col, int segments = 0) {
+        if(segments <= 0) segments = segmentsFor(radius);
+        const float* unit = unitCircle(segments);
+        for(int i = 0; i < segments; i++) {
+            int next = (i + 1) % segments;
+            mesh.addVertex(cx + radius * unit[2 * i], cy + radius * unit[2 * i + 1], col);
+            mesh.addVertex(cx + radius * unit[2 * next], cy + radius * unit[2 * next + 1], col);
+        }
+    }
+    
+    // Open arc from startDeg to endDeg (counter-clockwise) as line segments
+    template<class Sink>
+    static void appendArc(Sink& mesh, float cx, float cy, float radius,
+                          float startDeg, float endDeg, Color col, int segments = 0) {
+        float sweep = (endDeg - startDeg) * 3.14159f / 180.0f;
+        if(segments <= 0) {
+            segments = static_cast<int>(ceilf(segmentsFor(radius) * fabsf(sweep) / (2.0f * 3.14159f)));
+            if(segments < 1) segments = 1;
+        }
+        
+        // Step by complex multiplication so only the endpoints need trig
+        float start = startDeg * 3.14159f / 180.0f;
+        float c = cosf(start), s = sinf(start);
+        float stepC = cosf(sweep / segments), stepS = sinf(sweep / segments);
+        for(int i = 0; i < segments; i++) {
+            float nc = c * stepC - s * stepS;
+            float ns = c * stepS + s * stepC;
+            mesh.addVertex(cx + radius * c, cy + radius * s, col);
+            mesh.addVertex(cx + radius * nc, cy + radius * ns, col);
+            c = nc;
+            s = ns;
+        }
+    }
+};
+
+vector<vector<float>> CircleLibrary::unitTables;
+float CircleLibrary::pixelsPerUnit = 1.0f;
+
+
+/**
+ * @struct WindmillShape
+ * @brief Dimensions that decide a windmill's geometry
+ */
+struct WindmillShape {
+    float towerWidth;
+    float towerHeight;
+    float bladeLength;
+    int numBlades;
+    
+    bool operator==(const WindmillShape& o) const {
+        return towerWidth == o.towerWidth && towerHeight == o.towerHeight
+            && bladeLength == o.bladeLength && numBlades == o.numBlades;
+    }
+};
+
+
+/**
+ * @class WindmillTemplate
+ * @brief Prebuilt meshes shared by every windmill with the same shape
+ *
+ * The body is in local space with the tower base at the origin; the rotor
+ * and hub are centred on the hub so one glRotatef spins all blades.
+ */
+class WindmillTemplate {
+public:
+    WindmillShape shape;
+    Mesh body;           // Tower and door
+    Mesh rotor;          // All blade fills
+    Mesh rotorOutline;   // All blade outlines
+    Mesh hub;            // Hub and centre bolt
+    
+    explicit WindmillTemplate(const WindmillShape& s)
+        : shape(s), body(GL_TRIANGLES), rotor(GL_TRIANGLES),
+          rotorOutline(GL_LINES), hub(GL_TRIANGLES) {
+        build();
+    }
+    
+    // Regenerate in place, e.g. when the circle level of detail changes
+    void rebuild() {
+        body.clear();
+        rotor.clear();
+        rotorOutline.clear();
+        hub.clear();
+        build();
+    }
+    
+private:
+    void build() {
+        float w = shape.towerWidth;
+        float h = shape.towerHeight;
+        float len = shape.bladeLength;
+        
+        // Tower trapezoid and door
+        body.addPolygon({-w/2, 0, w/2, 0, w/3, h, -w/3, h}, Color(0.55f, 0.27f, 0.07f));
+        body.addPolygon({-8, 0, 8, 0, 8, 30, -8, 30}, Color(0.3f, 0.15f, 0.05f));
+        
+        // Blades, pre-rotated into their slots around the hub
+        float angleStep = 2.0f * 3.14159f / shape.numBlades;
+        float outline[] = {0.0f, 0.0f, -5.0f, len * 0.3f, -3.0f, len, 3.0f, len, 5.0f, len * 0.3f};
+        for(int i = 0; i < shape.numBlades; i++) {
+            float c = cosf(i * angleStep);
+            float s = sinf(i * angleStep);
+            vector<float> blade;
+            for(int k = 0; k < 5; k++) {
+                float px = outline[2 * k];
+                float py = outline[2 * k + 1];
+                blade.push_back(px * c - py * s);
+                blade.push_back(px * s + py * c);
+            }
+            rotor.addPolygon(blade, Color(0.95f, 0.95f, 0.90f));
+            rotorOutline.addLineLoop(blade, Color(0.7f, 0.7f, 0.65f));
+        }
+        
+        CircleLibrary::appendDisc(hub, 0, 0, 15.0f, Color(0.3f, 0.3f, 0.3f));
+        CircleLibrary::appendDisc(hub, 0, 0, 8.0f, Color(0.2f, 0.2f, 0.2f));
+        
+        body.upload();
+        rotor.upload();
+        rotorOutline.upload();
+        hub.upload();
+    }
+};
+
+
+/**
+ * @class GeometryCache
+ * @brief Owns the retained-mode meshes, built on first use
+ */
+class GeometryCache {
+private:
+    static vector<unique_ptr<WindmillTemplate>> windmillTemplates;
+    static unique_ptr<Mesh> selectionRing;
+    
+public:
+    static const WindmillTemplate* windmillTemplate(const WindmillShape& shape) {
+        for(auto& t : windmillTemplates) {
+            if(t->shape == shape) return t.get();
+        }
+        windmillTemplates.push_back(unique_ptr<WindmillTemplate>(new WindmillTemplate(shape)));
+        return windmillTemplates.back().get();
+    }
+    
+    // Unit-radius ring, scaled to size when drawn
+    static const Mesh* selectionIndicator() {
+        if(!selectionRing) {
+            selectionRing.reset(new Mesh(GL_LINES));
+            CircleLibrary::appendRing(*selectionRing, 0, 0, 1.0f, Color(1.0f, 1.0f, 0.0f),
+                                      CircleLibrary::segmentsFor(SELECTION_RADIUS));
+            selectionRing->upload();
+        }
+        return selectionRing.get();
+    }
+    
+    // Rebuild round parts after the pixel scale changed; pointers stay valid
+    static void refreshDetail() {
+        for(auto& t : windmillTemplates) {
+            t->rebuild();
+        }
+        if(selectionRing) {
+            selectionRing->clear();
+            CircleLibrary::appendRing(*selectionRing, 0, 0, 1.0f, Color(1.0f, 1.0f, 0.0f),
+                                      CircleLibrary::segmentsFor(SELECTION_RADIUS));
+            selectionRing->upload();
+        }
+    }
+};
+
+vector<unique_ptr<WindmillTemplate>> GeometryCache::windmillTemplates;
+unique_ptr<Mesh> GeometryCache::selectionRing;
+
+
+
+/**
+ * @class RenderBackend
+ * @brief Destination for a frame's geometry: the GL driver or the CPU rasteriser
+ *
+ * Geometry arrives as list primitives (GL_TRIANGLES, GL_LINES) in world
+ * coordinates with per-vertex colour.
+ *
+ * Static layers are framebuffer-sized images kept between frames: drawn
+ * once between beginLayer() and endLayer(), then used to start frames with
+ * a single copy. They are dropped when the framebuffer size changes.
+ */
+class RenderBackend {
+public:
+    static const int MAX_LAYERS = 4;
+    
+    virtual ~RenderBackend() {}
+    
+    // True when draws go through the current OpenGL context
+    virtual bool usesOpenGL() const = 0;
+    
+    virtual void beginFrame(const Color& clear) = 0;
+    virtual void drawArrays(GLenum primitive, const ColorVertex* vertices, size_t count,
+                            float lineWidth) = 0;
+    virtual void endFrame() = 0;
+    
+    // Restricts the clear and all drawing to part of the framebuffer
+    virtual void setClip(const PixelRect& clip) = 0;
+    virtual void clearClip() = 0;
+    
+    // Static layers; beginLayer() returns false when layers are unsupported
+    virtual bool hasLayer(int slot) const = 0;
+    virtual bool beginLayer(int slot) = 0;
+    virtual void endLayer() = 0;
+    virtual void beginFrameFromLayer(int slot) = 0;  // Like beginFrame(), copying instead of clearing
+};
+
+
+/**
+ * @class GLBackend
+ * @brief Fixed-function OpenGL with client-side vertex arrays
  */
-class Cloud : public Drawable {
+class GLBackend : public RenderBackend {
 private:
-    float speed;         // Private member 
-    float size;
+    // Static layers live in framebuffer objects and are composited with a blit
+    struct Layer {
+        GLuint framebuffer = 0, colorBuffer = 0;
+        int width = 0, height = 0;
+        bool valid = false;
+    };
+    
+    Layer layers[MAX_LAYERS];
+    int currentLayer = -1;
+    GLint resumeFramebuffer = 0;   // Draw target to go back to after a layer
+    GLboolean resumeScissor = GL_FALSE;
+    bool layersFailed = false;
     
 public:
-    Cloud(float posX, float posY, float spd = 0.3f, float sz = 25.0f)
-        : Drawable(posX, posY), speed(spd), size(sz) {}
+    bool usesOpenGL() const override { return true; }
+    
+    void beginFrame(const Color& clear) override {
+        glClearColor(clear.r, clear.g, clear.b, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    
+    void drawArrays(GLenum primitive, const ColorVertex* vertices, size_t count,
+                    float lineWidth) override {
+        if(count == 0) return;
+        if(lineWidth != 1.0f) glLineWidth(lineWidth);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(ColorVertex), &vertices[0].x);
+        glColorPointer(3, GL_FLOAT, sizeof(ColorVertex), &vertices[0].r);
+        glDrawArrays(primitive, 0, static_cast<GLsizei>(count));
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        if(lineWidth != 1.0f) glLineWidth(1.0f);
+    }
+    
+    void endFrame() override {}
+    
+    void setClip(const PixelRect& clip) override {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(clip.x, clip.y, clip.width, clip.height);
+    }
+    
+    void clearClip() override { glDisable(GL_SCISSOR_TEST); }
     
-    void draw() override {  // Override virtual function
-        if(!visible) return;
+    bool hasLayer(int slot) const override {
+        const Layer& l = layers[slot];
+        return l.valid && l.width == viewportWidth && l.height == viewportHeight;
+    }
+    
+    bool beginLayer(int slot) override {
+        if(layersFailed || !glExt.hasFramebuffers()) return false;
+        
+        Layer& l = layers[slot];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &resumeFramebuffer);
+        if(!l.framebuffer) {
+            glExt.genFramebuffers(1, &l.framebuffer);
+            glExt.genRenderbuffers(1, &l.colorBuffer);
+        }
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, l.framebuffer);
         
-        glColor3f(1.0f, 1.0f, 1.0f);  // White
+        if(l.width != viewportWidth || l.height != viewportHeight) {
+            glExt.bindRenderbuffer(GL_RENDERBUFFER, l.colorBuffer);
+            glExt.renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, viewportWidth, viewportHeight);
+            glExt.bindRenderbuffer(GL_RENDERBUFFER, 0);
+            glExt.framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          GL_RENDERBUFFER, l.colorBuffer);
+            if(glExt.checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                cerr << "Layer framebuffer incomplete; drawing static layers every frame" << endl;
+                glExt.bindFramebuffer(GL_FRAMEBUFFER, resumeFramebuffer);
+                layersFailed = true;
+                return false;
+            }
+            l.width = viewportWidth;
+            l.height = viewportHeight;
+        }
         
-       
-        drawCircle(x, y, size);
-        drawCircle(x + size * 0.8f, y + size * 0.3f, size * 0.9f);
-        drawCircle(x - size * 0.8f, y + size * 0.3f, size * 0.7f);
-        drawCircle(x + size * 0.4f, y - size * 0.2f, size * 0.6f);
-        drawCircle(x - size * 0.4f, y - size * 0.2f, size * 0.6f);
+        // Layers always cover the whole framebuffer
+        resumeScissor = glIsEnabled(GL_SCISSOR_TEST);
+        glDisable(GL_SCISSOR_TEST);
+        currentLayer = slot;
+        return true;
+    }
+    
+    void endLayer() override {
+        layers[currentLayer].valid = true;
+        currentLayer = -1;
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, resumeFramebuffer);
+        if(resumeScissor) glEnable(GL_SCISSOR_TEST);
+    }
+    
+    // The blit honours the scissor, so a clipped pass copies only its area
+    void beginFrameFromLayer(int slot) override {
+        GLint target = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+        const Layer& l = layers[slot];
+        glExt.bindFramebuffer(GL_READ_FRAMEBUFFER, l.framebuffer);
+        glExt.blitFramebuffer(0, 0, l.width, l.height, 0, 0, l.width, l.height,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glExt.bindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    }
+};
+
+
+/**
+ * @class JobSystem
+ * @brief Work-stealing pool that splits index ranges across persistent threads
+ *
+ * parallelFor() cuts [0, count) into chunks of `grain` items and deals
+ * contiguous runs of chunks to per-thread deques. A thread works through
+ * its own deque from the back and, once it is empty, steals from the
+ * front of the others. The caller is thread 0 and returns only when every
+ * chunk is done. No chunk spawns more work, so empty deques everywhere
+ * means the loop is finished.
+ */
+class JobSystem {
+public:
+    // Chunks start on a 64-byte boundary of a float array
+    static const size_t GRAIN_ALIGN = 16;
+    static const size_t DEFAULT_GRAIN = 16384;
+    
+private:
+    struct Range {
+        size_t begin, end;
+    };
+    
+    struct Queue {
+        mutex lock;
+        deque<Range> ranges;
+    };
+    
+    vector<thread> threads;
+    unique_ptr<Queue[]> queues;   // One per thread, caller included
+    size_t grain;
+    mutex lock;
+    condition_variable wake, done;
+    const function<void(size_t, size_t)>* job;
+    unsigned generation;
+    int running;
+    bool quit;
+    
+public:
+    JobSystem() : queues(new Queue[1]), grain(DEFAULT_GRAIN), job(nullptr),
+                  generation(0), running(0), quit(false) {}
+    
+    ~JobSystem() { stop(); }
+    
+    // Restarts the pool; call while no loop is running
+    void configure(int threadCount, size_t grainSize) {
+        stop();
+        grain = max(GRAIN_ALIGN, (grainSize + GRAIN_ALIGN - 1) / GRAIN_ALIGN * GRAIN_ALIGN);
+        int count = max(1, threadCount);
+        queues.reset(new Queue[count]);
+        quit = false;
+        generation = 0;
+        for(int i = 1; i < count; i++) {
+            threads.push_back(thread(&JobSystem::loop, this, i));
+        }
+    }
+    
+    int size() const { return static_cast<int>(threads.size()) + 1; }
+    size_t getGrain() const { return grain; }
+    
+    // Calls fn(begin, end) over disjoint chunks covering [0, count)
+    void parallelFor(size_t count, const function<void(size_t, size_t)>& fn) {
+        parallelFor(count, grain, fn);
     }
     
-    void update() override {  // Override virtual function 
-        if(isPaused) return;
+    // The same with chunks of chunkSize items, for work that is not a row
+    // loop; only the configured grain keeps chunks on GRAIN_ALIGN boundaries
+    void parallelFor(size_t count, size_t chunkSize, const function<void(size_t, size_t)>& fn) {
+        if(count <= chunkSize || threads.empty()) {
+            if(count > 0) fn(0, count);
+            return;
+        }
+        
+        int n = size();
+        size_t chunks = (count + chunkSize - 1) / chunkSize;
+        for(int w = 0; w < n; w++) {
+            lock_guard<mutex> guard(queues[w].lock);
+            for(size_t c = chunks * w / n; c < chunks * (w + 1) / n; c++) {
+                queues[w].ranges.push_back(Range{c * chunkSize, min(count, (c + 1) * chunkSize)});
+            }
+        }
         
-        x += speed;
+        {
+            lock_guard<mutex> guard(lock);
+            job = &fn;
+            running = static_cast<int>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+        work(0, fn);
         
-        // Wrap around screen
-        if(x > 450.0f) {
-            x = -450.0f;
-            y = randomFloat(150.0f, 280.0f);
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this] { return running == 0; });
+        job = nullptr;
+    }
+    
+private:
+    void stop() {
+        {
+            lock_guard<mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for(thread& t : threads) t.join();
+        threads.clear();
+    }
+    
+    // Newest chunk from our own deque, else the oldest from someone else's
+    bool take(int index, Range& range) {
+        {
+            Queue& own = queues[index];
+            lock_guard<mutex> guard(own.lock);
+            if(!own.ranges.empty()) {
+                range = own.ranges.back();
+                own.ranges.pop_back();
+                return true;
+            }
+        }
+        int n = size();
+        for(int i = 1; i < n; i++) {
+            Queue& victim = queues[(index + i) % n];
+            lock_guard<mutex> guard(victim.lock);
+            if(!victim.ranges.empty()) {
+                range = victim.ranges.front();
+                victim.ranges.pop_front();
+                return true;
+            }
         }
+        return false;
+    }
+    
+    void work(int index, const function<void(size_t, size_t)>& fn) {
+        Range range;
+        while(take(index, range)) fn(range.begin, range.end);
     }
     
-    // Getter
-    float getSpeed() const { return speed; }
-    void setSpeed(float s) { speed = s; }
+    void loop(int index) {
+        unsigned seen = 0;
+        for(;;) {
+            const function<void(size_t, size_t)>* fn;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return quit || generation != seen; });
+                if(quit) return;
+                seen = generation;
+                fn = job;
+            }
+            work(index, *fn);
+            {
+                lock_guard<mutex> guard(lock);
+                if(--running == 0) done.notify_one();
+            }
+        }
+    }
+};
+
+// Splits the simulation step and CPU rasterisation across cores; configured
+// from the command line
+JobSystem jobs;
+
+
+/**
+ * @class SoftwareRasterizer
+ * @brief Tiled, multithreaded CPU rasteriser for machines without a GPU
+ *
+ * Draws are recorded during the frame. endFrame() sets up and bins the
+ * primitives into 64x64 pixel tiles in one contiguous slice per job
+ * thread (slices are merged in order, so per-tile order is still
+ * submission order), then rasterises the tiles in parallel. Both passes
+ * run on the shared job system. Triangles use edge functions evaluated
+ * four pixels at a time with SSE2 and the top-left fill rule; lines are
+ * drawn with coverage-based antialiasing and source-alpha blending like
+ * GL_LINE_SMOOTH. The framebuffer is RGBA8, bottom row first, the same
+ * layout glReadPixels returns.
+ */
+class SoftwareRasterizer : public RenderBackend {
+private:
+    static const int TILE_SIZE = 64;
+    static const uint32_t LINE_BIT = 0x80000000u;  // Bin entries tagged as lines
+    
+    struct Triangle {
+        float a[3], b[3], c[3];   // Edge functions, positive inside
+        bool topLeft[3];
+        float invArea;
+        float r[3], g[3], bl[3];
+        bool flat;
+        int minX, minY, maxX, maxY;
+    };
+    
+    struct Line {
+        float x0, y0, x1, y1;
+        float halfWidth;
+        float r, g, b;
+        int minX, minY, maxX, maxY;
+    };
+    
+    struct Draw {
+        GLenum primitive;
+        size_t first, count;
+        float lineWidth;
+    };
+    
+    int width, height;
+    int tilesX, tilesY;
+    vector<uint32_t> pixels;
+    int clipX0, clipY0, clipX1, clipY1;  // Inclusive pixel bounds of the clip
+    
+    vector<uint32_t> layers[MAX_LAYERS];  // Empty when not cached
+    int currentLayer;
+    int savedClip[4];
+    
+    vector<ColorVertex> vertices;   // Everything recorded this frame
+    vector<Draw> draws;
+    
+    vector<vector<Triangle>> triangles;         // Per slice
+    vector<vector<Line>> lines;                 // Per slice
+    vector<vector<vector<uint32_t>>> bins;      // Per slice, per tile
+    
+public:
+    SoftwareRasterizer(int w, int h)
+        : width(0), height(0), tilesX(0), tilesY(0), currentLayer(-1) {
+        resize(w, h);
+    }
+    
+    bool usesOpenGL() const override { return false; }
+    
+    void resize(int w, int h) {
+        width = max(1, w);
+        height = max(1, h);
+        tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        pixels.assign(width * height, 0);
+        clearClip();
+        for(auto& layer : layers) layer.clear();
+        
+        int n = jobs.size();
+        triangles.assign(n, vector<Triangle>());
+        lines.assign(n, vector<Line>());
+        bins.assign(n, vector<vector<uint32_t>>(tilesX * tilesY));
+    }
+    
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const uint32_t* getPixels() const { return pixels.data(); }
+    
+    void setClip(const PixelRect& clip) override {
+        clipX0 = max(0, clip.x);
+        clipY0 = max(0, clip.y);
+        clipX1 = min(width, clip.x + clip.width) - 1;
+        clipY1 = min(height, clip.y + clip.height) - 1;
+    }
+    
+    void clearClip() override {
+        clipX0 = 0;
+        clipY0 = 0;
+        clipX1 = width - 1;
+        clipY1 = height - 1;
+    }
+    
+    void beginFrame(const Color& clear) override {
+        uint32_t color = packColor(clear.r, clear.g, clear.b);
+        for(int y = clipY0; y <= clipY1; y++) {
+            fill(pixels.begin() + y * width + clipX0, pixels.begin() + y * width + clipX1 + 1, color);
+        }
+        vertices.clear();
+        draws.clear();
+    }
+    
+    bool hasLayer(int slot) const override { return !layers[slot].empty(); }
+    
+    // Draws into the layer's buffer by swapping it in as the framebuffer
+    bool beginLayer(int slot) override {
+        layers[slot].resize(pixels.size());
+        pixels.swap(layers[slot]);
+        savedClip[0] = clipX0;
+        savedClip[1] = clipY0;
+        savedClip[2] = clipX1;
+        savedClip[3] = clipY1;
+        clearClip();
+        currentLayer = slot;
+        return true;
+    }
+    
+    void endLayer() override {
+        pixels.swap(layers[currentLayer]);
+        clipX0 = savedClip[0];
+        clipY0 = savedClip[1];
+        clipX1 = savedClip[2];
+        clipY1 = savedClip[3];
+        currentLayer = -1;
+    }
+    
+    void beginFrameFromLayer(int slot) override {
+        const vector<uint32_t>& layer = layers[slot];
+        for(int y = clipY0; y <= clipY1; y++) {
+            copy(layer.begin() + y * width + clipX0, layer.begin() + y * width + clipX1 + 1,
+                 pixels.begin() + y * width + clipX0);
+        }
+        vertices.clear();
+        draws.clear();
+    }
+    
+    void drawArrays(GLenum primitive, const ColorVertex* v, size_t count, float lineWidth) override {
+        if(count == 0) return;
+        draws.push_back({primitive, vertices.size(), count, lineWidth});
+        vertices.insert(vertices.end(), v, v + count);
+    }
+    
+    void endFrame() override {
+        // Primitive index of every draw's first vertex, for slicing the work
+        size_t total = 0;
+        vector<size_t> primStart(draws.size() + 1);
+        for(size_t d = 0; d < draws.size(); d++) {
+            primStart[d] = total;
+            total += draws[d].count / (draws[d].primitive == GL_TRIANGLES ? 3 : 2);
+        }
+        primStart[draws.size()] = total;
+        
+        size_t n = bins.size();
+        jobs.parallelFor(n, 1, [&](size_t first, size_t last) {
+            for(size_t slice = first; slice < last; slice++) {
+                binRange(static_cast<int>(slice), primStart, total * slice / n, total * (slice + 1) / n);
+            }
+        });
+        
+        jobs.parallelFor(tilesX * tilesY, 1, [&](size_t first, size_t last) {
+            for(size_t tile = first; tile < last; tile++) rasterizeTile(static_cast<int>(tile));
+        });
+    }
+    
+private:
+    static uint32_t packColor(float r, float g, float b) {
+        uint32_t R = static_cast<uint32_t>(min(max(r, 0.0f), 1.0f) * 255.0f + 0.5f);
+        uint32_t G = static_cast<uint32_t>(min(max(g, 0.0f), 1.0f) * 255.0f + 0.5f);
+        uint32_t B = static_cast<uint32_t>(min(max(b, 0.0f), 1.0f) * 255.0f + 0.5f);
+        return R | (G << 8) | (B << 16) | 0xFF000000u;
+    }
+    
+    // World coordinates to pixel coordinates (pixel centres at +0.5)
+    float toPixelX(float x) const { return (x + WORLD_WIDTH / 2) * width / WORLD_WIDTH; }
+    float toPixelY(float y) const { return (y + WORLD_HEIGHT / 2) * height / WORLD_HEIGHT; }
+    
+    void binRange(int slice, const vector<size_t>& primStart, size_t begin, size_t end) {
+        vector<Triangle>& tris = triangles[slice];
+        vector<Line>& segs = lines[slice];
+        vector<vector<uint32_t>>& tileBins = bins[slice];
+        tris.clear();
+        segs.clear();
+        for(auto& bin : tileBins) bin.clear();
+        if(begin >= end) return;
+        
+        size_t d = upper_bound(primStart.begin(), primStart.end(), begin) - primStart.begin() - 1;
+        for(size_t prim = begin; prim < end; prim++) {
+            while(prim >= primStart[d + 1]) d++;
+            const Draw& draw = draws[d];
+            size_t local = prim - primStart[d];
+            
+            int minX, minY, maxX, maxY;
+            uint32_t entry;
+            if(draw.primitive == GL_TRIANGLES) {
+                if(!setupTriangle(&vertices[draw.first + local * 3], tris)) continue;
+                const Triangle& t = tris.back();
+                minX = t.minX; minY = t.minY; maxX = t.maxX; maxY = t.maxY;
+                entry = static_cast<uint32_t>(tris.size() - 1);
+            } else {
+                if(!setupLine(&vertices[draw.first + local * 2], draw.lineWidth, segs)) continue;
+                const Line& l = segs.back();
+                minX = l.minX; minY = l.minY; maxX = l.maxX; maxY = l.maxY;
+                entry = static_cast<uint32_t>(segs.size() - 1) | LINE_BIT;
+            }
+            
+            for(int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++) {
+                for(int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++) {
+                    tileBins[ty * tilesX + tx].push_back(entry);
+                }
+            }
+        }
+    }
+    
+    bool setupTriangle(const ColorVertex* v, vector<Triangle>& out) {
+        float px[3], py[3];
+        int order[3] = {0, 1, 2};
+        for(int i = 0; i < 3; i++) {
+            px[i] = toPixelX(v[i].x);
+            py[i] = toPixelY(v[i].y);
+        }
+        
+        float area = (px[1] - px[0]) * (py[2] - py[0]) - (py[1] - py[0]) * (px[2] - px[0]);
+        if(area == 0.0f) return false;
+        if(area < 0.0f) {
+            // Make the winding counter-clockwise
+            swap(px[1], px[2]);
+            swap(py[1], py[2]);
+            swap(order[1], order[2]);
+            area = -area;
+        }
+        
+        float fminX = min(px[0], min(px[1], px[2]));
+        float fmaxX = max(px[0], max(px[1], px[2]));
+        float fminY = min(py[0], min(py[1], py[2]));
+        float fmaxY = max(py[0], max(py[1], py[2]));
+        
+        Triangle t;
+        t.minX = max(clipX0, static_cast<int>(floorf(fminX)));
+        t.minY = max(clipY0, static_cast<int>(floorf(fminY)));
+        t.maxX = min(clipX1, static_cast<int>(ceilf(fmaxX)));
+        t.maxY = min(clipY1, static_cast<int>(ceilf(fmaxY)));
+        if(t.minX > t.maxX || t.minY > t.maxY) return false;
+        
+        // Edge k is opposite vertex k. Shared edges are always evaluated from
+        // the same endpoint and negated as needed, so neighbouring triangles
+        // get exactly opposite values and no pixel falls between them.
+        for(int k = 0; k < 3; k++) {
+            int i = (k + 1) % 3, j = (k + 2) % 3;
+            bool flip = px[i] > px[j] || (px[i] == px[j] && py[i] > py[j]);
+            int from = flip ? j : i, to = flip ? i : j;
+            float dx = px[to] - px[from];
+            float dy = py[to] - py[from];
+            float sign = flip ? -1.0f : 1.0f;
+            t.a[k] = -dy * sign;
+            t.b[k] = dx * sign;
+            t.c[k] = (dy * px[from] - dx * py[from]) * sign;
+            t.topLeft[k] = (dy * sign) < 0.0f || (dy == 0.0f && (dx * sign) < 0.0f);
+        }
+        
+        t.invArea = 1.0f / area;
+        t.flat = true;
+        for(int k = 0; k < 3; k++) {
+            const ColorVertex& cv = v[order[k]];
+            t.r[k] = cv.r;
+            t.g[k] = cv.g;
+            t.bl[k] = cv.b;
+            if(cv.r != t.r[0] || cv.g != t.g[0] || cv.b != t.bl[0]) t.flat = false;
+        }
+        
+        out.push_back(t);
+        return true;
+    }
+    
+    bool setupLine(const ColorVertex* v, float lineWidth, vector<Line>& out) {
+        Line l;
+        l.x0 = toPixelX(v[0].x);
+        l.y0 = toPixelY(v[0].y);
+        l.x1 = toPixelX(v[1].x);
+        l.y1 = toPixelY(v[1].y);
+        l.halfWidth = max(lineWidth, 1.0f) * 0.5f;
+        l.r = v[0].r;
+        l.g = v[0].g;
+        l.b = v[0].b;
+        
+        float reach = l.halfWidth + 1.0f;
+        l.minX = max(clipX0, static_cast<int>(floorf(min(l.x0, l.x1) - reach)));
+        l.minY = max(clipY0, static_cast<int>(floorf(min(l.y0, l.y1) - reach)));
+        l.maxX = min(clipX1, static_cast<int>(ceilf(max(l.x0, l.x1) + reach)));
+        l.maxY = min(clipY1, static_cast<int>(ceilf(max(l.y0, l.y1) + reach)));
+        if(l.minX > l.maxX || l.minY > l.maxY) return false;
+        
+        out.push_back(l);
+        return true;
+    }
+    
+    void rasterizeTile(int tile) {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        int x1 = min(x0 + TILE_SIZE, width) - 1;
+        int y1 = min(y0 + TILE_SIZE, height) - 1;
+        
+        // Worker slices are in submission order, so walking them in turn keeps painter's order
+        for(size_t w = 0; w < bins.size(); w++) {
+            for(uint32_t entry : bins[w][tile]) {
+                if(entry & LINE_BIT) {
+                    drawLine(lines[w][entry & ~LINE_BIT], x0, y0, x1, y1);
+                } else {
+                    drawTriangle(triangles[w][entry], x0, y0, x1, y1);
+                }
+            }
+        }
+    }
+    
+    void drawTriangle(const Triangle& t, int tx0, int ty0, int tx1, int ty1) {
+        int minX = max(t.minX, tx0), maxX = min(t.maxX, tx1);
+        int minY = max(t.minY, ty0), maxY = min(t.maxY, ty1);
+        if(minX > maxX || minY > maxY) return;
+        
+        uint32_t flatColor = packColor(t.r[0], t.g[0], t.bl[0]);
+        
+        for(int y = minY; y <= maxY; y++) {
+            uint32_t* row = &pixels[y * width];
+            float cy = y + 0.5f;
+            int x = minX;
+#ifdef __SSE2__
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            __m128 rowC[3], stepA[3];
+            for(int k = 0; k < 3; k++) {
+                rowC[k] = _mm_set1_ps(t.b[k] * cy + t.c[k]);
+                stepA[k] = _mm_set1_ps(t.a[k]);
+            }
+            for(; x + 3 <= maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane);
+                __m128 e[3];
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for(int k = 0; k < 3; k++) {
+                    e[k] = _mm_add_ps(_mm_mul_ps(stepA[k], px), rowC[k]);
+                    __m128 test = t.topLeft[k] ? _mm_cmpge_ps(e[k], zero) : _mm_cmpgt_ps(e[k], zero);
+                    inside = _mm_and_ps(inside, test);
+                }
+                int mask = _mm_movemask_ps(inside);
+                if(!mask) continue;
+                
+                __m128i color;
+                if(t.flat) {
+                    color = _mm_set1_epi32(static_cast<int>(flatColor));
+                } else {
+                    color = shadeFour(t, e);
+                }
+                __m128i keep = _mm_castps_si128(inside);
+                __m128i* dst = reinterpret_cast<__m128i*>(row + x);
+                __m128i old = _mm_loadu_si128(dst);
+                _mm_storeu_si128(dst, _mm_or_si128(_mm_and_si128(keep, color),
+                                                   _mm_andnot_si128(keep, old)));
+            }
+#endif
+            // Remaining pixels (or all of them without SSE2)
+            for(; x <= maxX; x++) {
+                float cx = x + 0.5f;
+                float e[3];
+                bool inside = true;
+                for(int k = 0; k < 3; k++) {
+                    e[k] = t.a[k] * cx + (t.b[k] * cy + t.c[k]);  // Same order as the SSE path
+                    inside = inside && (t.topLeft[k] ? e[k] >= 0.0f : e[k] > 0.0f);
+                }
+                if(!inside) continue;
+                if(t.flat) {
+                    row[x] = flatColor;
+                } else {
+                    float w0 = e[0] * t.invArea, w1 = e[1] * t.invArea, w2 = e[2] * t.invArea;
+                    row[x] = packColor(w0 * t.r[0] + w1 * t.r[1] + w2 * t.r[2],
+                                       w0 * t.g[0] + w1 * t.g[1] + w2 * t.g[2],
+                                       w0 * t.bl[0] + w1 * t.bl[1] + w2 * t.bl[2]);
+                }
+            }
+        }
+    }
+    
+#ifdef __SSE2__
+    // Gouraud colour for four pixels from their edge values
+    static __m128i shadeFour(const Triangle& t, const __m128 e[3]) {
+        __m128 inv = _mm_set1_ps(t.invArea);
+        __m128 w0 = _mm_mul_ps(e[0], inv), w1 = _mm_mul_ps(e[1], inv), w2 = _mm_mul_ps(e[2], inv);
+        __m128 scale = _mm_set1_ps(255.0f);
+        __m128 half = _mm_set1_ps(0.5f);
+        __m128 hi = _mm_set1_ps(255.0f);
+        __m128 lo = _mm_setzero_ps();
+        
+        const float* channels[3] = {t.r, t.g, t.bl};
+        __m128i packed = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        for(int ch = 0; ch < 3; ch++) {
+            const float* c = channels[ch];
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(c[0])),
+                                             _mm_mul_ps(w1, _mm_set1_ps(c[1]))),
+                                  _mm_mul_ps(w2, _mm_set1_ps(c[2])));
+            v = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v, scale), half), lo), hi);
+            __m128i bytes = _mm_cvttps_epi32(v);
+            packed = _mm_or_si128(packed, _mm_slli_epi32(bytes, ch * 8));
+        }
+        return packed;
+    }
+#endif
+    
+    // Antialiased line: coverage from the distance to the segment, blended by source alpha
+    void drawLine(const Line& l, int tx0, int ty0, int tx1, int ty1) {
+        int minX = max(l.minX, tx0), maxX = min(l.maxX, tx1);
+        int minY = max(l.minY, ty0), maxY = min(l.maxY, ty1);
+        
+        float dx = l.x1 - l.x0, dy = l.y1 - l.y0;
+        float lengthSq = dx * dx + dy * dy;
+        float invLengthSq = lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f;
+        
+        for(int y = minY; y <= maxY; y++) {
+            uint32_t* row = &pixels[y * width];
+            float cy = y + 0.5f;
+            for(int x = minX; x <= maxX; x++) {
+                float cx = x + 0.5f;
+                float s = ((cx - l.x0) * dx + (cy - l.y0) * dy) * invLengthSq;
+                s = min(max(s, 0.0f), 1.0f);
+                float ex = l.x0 + s * dx - cx, ey = l.y0 + s * dy - cy;
+                float coverage = l.halfWidth + 0.5f - sqrtf(ex * ex + ey * ey);
+                if(coverage <= 0.0f) continue;
+                if(coverage > 1.0f) coverage = 1.0f;
+                
+                uint32_t old = row[x];
+                float keep = 1.0f - coverage;
+                float r = l.r * coverage + (old & 0xFF) / 255.0f * keep;
+                float g = l.g * coverage + ((old >> 8) & 0xFF) / 255.0f * keep;
+                float b = l.b * coverage + ((old >> 16) & 0xFF) / 255.0f * keep;
+                row[x] = packColor(r, g, b);
+            }
+        }
+    }
+};
+
+// Set by --renderer cpu; null means OpenGL
+SoftwareRasterizer* softwareRenderer = nullptr;
+GLBackend glBackend;
+
+RenderBackend& activeBackend() {
+    if(softwareRenderer) return *softwareRenderer;
+    return glBackend;
+}
+
+
+/**
+ * @struct RenderStats
+ * @brief Per-frame counters reported by the render queue
+ */
+struct RenderStats {
+    int commands;      // Submitted commands before merging
+    int drawCalls;
+    int stateChanges;  // Line width, texture, shader and array bindings
+    int passes;        // Scissored redraws; 0 when nothing changed
+    
+    RenderStats() : commands(0), drawCalls(0), stateChanges(0), passes(0) {}
+    
+    void add(const RenderStats& o) {
+        commands += o.commands;
+        drawCalls += o.drawCalls;
+        stateChanges += o.stateChanges;
+        passes += o.passes;
+    }
+};
+
+
+/**
+ * @class RenderBatch
+ * @brief Abstract renderer that draws many objects itself, slotted into the queue
+ */
+class RenderBatch {
+public:
+    virtual ~RenderBatch() {}
+    
+    virtual bool empty() const = 0;
+    virtual void render(RenderStats& stats) = 0;                     // OpenGL fast path
+    virtual void emit(RenderBackend& backend, RenderStats& stats) = 0; // Any backend
+};
+
+
+/**
+ * @struct WindmillInstance
+ * @brief Per-windmill data uploaded for instanced drawing
+ */
+struct WindmillInstance {
+    float x, y;          // Tower base
+    float scale;
+    float bladeAngle;    // Degrees
+    float selected;      // 1 when selected, 0 otherwise
+};
+
+
+/**
+ * @class FleetRenderer
+ * @brief Draws all windmills that share a template in a fixed number of calls
+ *
+ * Windmills submit a WindmillInstance each frame. With GL 3.3 instancing the
+ * instances go to a stream buffer and a small shader places each copy of
+ * the template meshes; otherwise the meshes are expanded on the CPU into one
+ * vertex array per mesh. Either way a template costs at most five draw
+ * calls (body, rotor, outline, hub, selection ring) however many windmills
+ * use it.
+ */
+class FleetRenderer : public RenderBatch {
+private:
+    struct Batch {
+        const WindmillTemplate* geometry;
+        vector<WindmillInstance> instances;
+        vector<WindmillInstance> selected;
+    };
+    
+    vector<Batch> batches;
+    size_t activeBatches;
+    
+    // Instanced path
+    GLuint program;
+    GLuint instanceBuffer;
+    GLint spinLoc, pivotLoc, meshScaleLoc;
+    bool triedProgram;
+    
+    // Fallback path
+    vector<ColorVertex> expanded;
+    
+    enum { ATTR_POSITION = 0, ATTR_COLOR = 1, ATTR_INSTANCE = 2 };
+    
+public:
+    FleetRenderer()
+        : activeBatches(0), program(0), instanceBuffer(0),
+          spinLoc(-1), pivotLoc(-1), meshScaleLoc(-1), triedProgram(false) {}
+    
+    void begin() {
+        for(size_t i = 0; i < activeBatches; i++) {
+            batches[i].instances.clear();
+            batches[i].selected.clear();
+        }
+        activeBatches = 0;
+    }
+    
+    void add(const WindmillTemplate* geometry, const WindmillInstance& inst) {
+        Batch* batch = nullptr;
+        for(size_t i = 0; i < activeBatches; i++) {
+            if(batches[i].geometry == geometry) { batch = &batches[i]; break; }
+        }
+        if(!batch) {
+            if(activeBatches == batches.size()) batches.push_back(Batch());
+            batch = &batches[activeBatches++];
+            batch->geometry = geometry;
+        }
+        batch->instances.push_back(inst);
+        if(inst.selected > 0.0f) batch->selected.push_back(inst);
+    }
+    
+    bool empty() const override { return activeBatches == 0; }
+    
+    void render(RenderStats& stats) override {
+        if(!triedProgram) createProgram();
+        
+        for(size_t i = 0; i < activeBatches; i++) {
+            const Batch& batch = batches[i];
+            const WindmillTemplate* t = batch.geometry;
+            float hubY = t->shape.towerHeight;
+            
+            drawMesh(t->body, batch.instances, false, 0.0f, 1.0f, stats);
+            drawMesh(t->rotor, batch.instances, true, hubY, 1.0f, stats);
+            drawMesh(t->rotorOutline, batch.instances, true, hubY, 1.0f, stats);
+            drawMesh(t->hub, batch.instances, false, hubY, 1.0f, stats);
+            
+            if(!batch.selected.empty()) {
+                glLineWidth(3.0f);
+                drawMesh(*GeometryCache::selectionIndicator(), batch.selected, false, hubY,
+                         SELECTION_RADIUS, stats);
+                glLineWidth(1.0f);
+                stats.stateChanges += 2;
+            }
+        }
+    }
+    
+    void emit(RenderBackend& backend, RenderStats& stats) override {
+        for(size_t i = 0; i < activeBatches; i++) {
+            const Batch& batch = batches[i];
+            const WindmillTemplate* t = batch.geometry;
+            float hubY = t->shape.towerHeight;
+            
+            emitMesh(backend, t->body, batch.instances, false, 0.0f, 1.0f, 1.0f, stats);
+            emitMesh(backend, t->rotor, batch.instances, true, hubY, 1.0f, 1.0f, stats);
+            emitMesh(backend, t->rotorOutline, batch.instances, true, hubY, 1.0f, 1.0f, stats);
+            emitMesh(backend, t->hub, batch.instances, false, hubY, 1.0f, 1.0f, stats);
+            emitMesh(backend, *GeometryCache::selectionIndicator(), batch.selected, false, hubY,
+                     SELECTION_RADIUS, 3.0f, stats);
+        }
+    }
+    
+private:
+    void createProgram() {
+        triedProgram = true;
+        if(!glExt.hasInstancing()) return;
+        
+        const char* vertexSource =
+            "#version 120\n"
+            "attribute vec2 position;\n"
+            "attribute vec3 color;\n"
+            "attribute vec4 instance;\n"   // x, y, scale, bladeAngle
+            "uniform float spin;\n"
+            "uniform vec2 pivot;\n"
+            "uniform float meshScale;\n"
+            "varying vec3 vColor;\n"
+            "void main() {\n"
+            "    float a = radians(instance.w) * spin;\n"
+            "    vec2 p = position * meshScale;\n"
+            "    p = vec2(p.x * cos(a) - p.y * sin(a), p.x * sin(a) + p.y * cos(a)) + pivot;\n"
+            "    p = p * instance.z + instance.xy;\n"
+            "    gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+            "    vColor = color;\n"
+            "}\n";
+        const char* fragmentSource =
+            "#version 120\n"
+            "varying vec3 vColor;\n"
+            "void main() {\n"
+            "    gl_FragColor = vec4(vColor, 1.0);\n"
+            "}\n";
+        
+        GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+        GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+        if(!vs || !fs) return;
+        
+        GLuint prog = glExt.createProgram();
+        glExt.attachShader(prog, vs);
+        glExt.attachShader(prog, fs);
+        glExt.bindAttribLocation(prog, ATTR_POSITION, "position");
+        glExt.bindAttribLocation(prog, ATTR_COLOR, "color");
+        glExt.bindAttribLocation(prog, ATTR_INSTANCE, "instance");
+        glExt.linkProgram(prog);
+        glExt.deleteShader(vs);
+        glExt.deleteShader(fs);
+        
+        GLint linked = 0;
+        glExt.getProgramiv(prog, GL_LINK_STATUS, &linked);
+        if(!linked) {
+            char log[512];
+            glExt.getProgramInfoLog(prog, sizeof(log), nullptr, log);
+            cerr << "Fleet shader link failed, using CPU batching: " << log << endl;
+            return;
+        }
+        
+        program = prog;
+        spinLoc = glExt.getUniformLocation(program, "spin");
+        pivotLoc = glExt.getUniformLocation(program, "pivot");
+        meshScaleLoc = glExt.getUniformLocation(program, "meshScale");
+        glExt.genBuffers(1, &instanceBuffer);
+    }
+    
+    static GLuint compileShader(GLenum type, const char* source) {
+        GLuint shader = glExt.createShader(type);
+        glExt.shaderSource(shader, 1, &source, nullptr);
+        glExt.compileShader(shader);
+        
+        GLint compiled = 0;
+        glExt.getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if(!compiled) {
+            char log[512];
+            glExt.getShaderInfoLog(shader, sizeof(log), nullptr, log);
+            cerr << "Fleet shader compile failed, using CPU batching: " << log << endl;
+            glExt.deleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+    
+    void drawMesh(const Mesh& mesh, const vector<WindmillInstance>& instances,
+                  bool spin, float pivotY, float meshScale, RenderStats& stats) {
+        if(instances.empty() || mesh.size() == 0) return;
+        stats.drawCalls++;
+        stats.stateChanges++;  // Array bindings for this mesh
+        if(program && mesh.getBuffer()) {
+            drawInstanced(mesh, instances, spin, pivotY, meshScale);
+        } else {
+            drawExpanded(mesh, instances, spin, pivotY, meshScale);
+        }
+    }
+    
+    void drawInstanced(const Mesh& mesh, const vector<WindmillInstance>& instances,
+                       bool spin, float pivotY, float meshScale) {
+        glExt.useProgram(program);
+        glExt.uniform1f(spinLoc, spin ? 1.0f : 0.0f);
+        glExt.uniform2f(pivotLoc, 0.0f, pivotY);
+        glExt.uniform1f(meshScaleLoc, meshScale);
+        
+        // Per-instance stream, orphaned every upload
+        glExt.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glExt.bufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(WindmillInstance),
+                         instances.data(), GL_STREAM_DRAW);
+        glExt.vertexAttribPointer(ATTR_INSTANCE, 4, GL_FLOAT, GL_FALSE,
+                                  sizeof(WindmillInstance), nullptr);
+        glExt.vertexAttribDivisor(ATTR_INSTANCE, 1);
+        glExt.enableVertexAttribArray(ATTR_INSTANCE);
+        
+        // Shared template geometry
+        glExt.bindBuffer(GL_ARRAY_BUFFER, mesh.getBuffer());
+        glExt.vertexAttribPointer(ATTR_POSITION, 2, GL_FLOAT, GL_FALSE, sizeof(ColorVertex), nullptr);
+        glExt.vertexAttribPointer(ATTR_COLOR, 3, GL_FLOAT, GL_FALSE, sizeof(ColorVertex),
+                                  reinterpret_cast<const void*>(2 * sizeof(float)));
+        glExt.enableVertexAttribArray(ATTR_POSITION);
+        glExt.enableVertexAttribArray(ATTR_COLOR);
+        
+        glExt.drawArraysInstanced(mesh.getPrimitive(), 0, mesh.size(),
+                                  static_cast<GLsizei>(instances.size()));
+        
+        glExt.disableVertexAttribArray(ATTR_POSITION);
+        glExt.disableVertexAttribArray(ATTR_COLOR);
+        glExt.disableVertexAttribArray(ATTR_INSTANCE);
+        glExt.vertexAttribDivisor(ATTR_INSTANCE, 0);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        glExt.useProgram(0);
+    }
+    
+    void drawExpanded(const Mesh& mesh, const vector<WindmillInstance>& instances,
+                      bool spin, float pivotY, float meshScale) {
+        expand(mesh, instances, spin, pivotY, meshScale);
+        
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(ColorVertex), &expanded[0].x);
+        glColorPointer(3, GL_FLOAT, sizeof(ColorVertex), &expanded[0].r);
+        glDrawArrays(mesh.getPrimitive(), 0, static_cast<GLsizei>(expanded.size()));
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    
+    // Every instance's copy of the mesh, in world space
+    void expand(const Mesh& mesh, const vector<WindmillInstance>& instances,
+                bool spin, float pivotY, float meshScale) {
+        const vector<ColorVertex>& src = mesh.getVertices();
+        expanded.resize(src.size() * instances.size());
+        
+        ColorVertex* out = expanded.data();
+        for(const WindmillInstance& inst : instances) {
+            float a = spin ? inst.bladeAngle * 3.14159f / 180.0f : 0.0f;
+            float c = cosf(a) * meshScale;
+            float s = sinf(a) * meshScale;
+            for(const ColorVertex& v : src) {
+                float px = v.x * c - v.y * s;
+                float py = v.x * s + v.y * c + pivotY;
+                *out = v;
+                out->x = px * inst.scale + inst.x;
+                out->y = py * inst.scale + inst.y;
+                out++;
+            }
+        }
+    }
+    
+    void emitMesh(RenderBackend& backend, const Mesh& mesh, const vector<WindmillInstance>& instances,
+                  bool spin, float pivotY, float meshScale, float lineWidth, RenderStats& stats) {
+        if(instances.empty() || mesh.size() == 0) return;
+        expand(mesh, instances, spin, pivotY, meshScale);
+        backend.drawArrays(mesh.getPrimitive(), expanded.data(), expanded.size(), lineWidth);
+        stats.drawCalls++;
+    }
+};
+
+
+
+/**
+ * @class CloudBatcher
+ * @brief Streams every cloud into one vertex buffer and draws it in one call
+ *
+ * Clouds only queue their position and size during submission. flush()
+ * then writes the puff triangles straight into a persistently mapped ring
+ * buffer split into three regions, fenced so the CPU never overwrites a
+ * region the GPU is still reading. Contexts without buffer storage fill a
+ * staging array and orphan a stream buffer instead.
+ */
+class CloudBatcher : public RenderBatch {
+public:
+    // Puff layout relative to the cloud centre: x offset, y offset, radius (all times size)
+    static const int PUFF_COUNT = 5;
+    static const float PUFFS[PUFF_COUNT][3];
+    
+private:
+    struct QueuedCloud {
+        float x, y, size;
+    };
+    
+    static const int REGIONS = 3;
+    
+    vector<QueuedCloud> queued;
+    size_t queuedVertices;
+    
+    GLuint buffer;
+    ColorVertex* mapped;        // Start of the persistent mapping
+    size_t regionCapacity;      // Vertices per region
+    int region;
+    GLsync fences[REGIONS];
+    
+    vector<ColorVertex> staging;  // Fallback path
+    
+public:
+    CloudBatcher()
+        : queuedVertices(0), buffer(0), mapped(nullptr), regionCapacity(0), region(0) {
+        for(int i = 0; i < REGIONS; i++) fences[i] = nullptr;
+    }
+    
+    ~CloudBatcher() {
+        release();
+    }
+    
+    CloudBatcher(const CloudBatcher&) = delete;
+    CloudBatcher& operator=(const CloudBatcher&) = delete;
+    
+    void begin() {
+        queued.clear();
+        queuedVertices = 0;
+    }
+    
+    void add(float x, float y, float size) {
+        queued.push_back({x, y, size});
+        for(int p = 0; p < PUFF_COUNT; p++) {
+            queuedVertices += 3 * CircleLibrary::segmentsFor(size * PUFFS[p][2]);
+        }
+    }
+    
+    bool empty() const override { return queued.empty(); }
+    
+    void render(RenderStats& stats) override {
+        if(queued.empty()) return;
+        stats.drawCalls++;
+        stats.stateChanges++;
+        
+        if(glExt.hasPersistentMapping()) {
+            flushMapped();
+        } else {
+            flushStaged();
+        }
+    }
+    
+    void emit(RenderBackend& backend, RenderStats& stats) override {
+        if(queued.empty()) return;
+        staging.resize(queuedVertices);
+        writeVertices(staging.data());
+        backend.drawArrays(GL_TRIANGLES, staging.data(), staging.size(), 1.0f);
+        stats.drawCalls++;
+    }
+    
+private:
+    void flushMapped() {
+        if(queuedVertices > regionCapacity) reserve(queuedVertices + queuedVertices / 2);
+        
+        region = (region + 1) % REGIONS;
+        if(fences[region]) {
+            glExt.clientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glExt.deleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+        
+        size_t first = region * regionCapacity;
+        writeVertices(mapped + first);
+        
+        glExt.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        drawArrays(nullptr, first);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        
+        fences[region] = glExt.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    
+    void flushStaged() {
+        staging.resize(queuedVertices);
+        writeVertices(staging.data());
+        
+        if(glExt.hasBuffers()) {
+            if(!buffer) glExt.genBuffers(1, &buffer);
+            glExt.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glExt.bufferData(GL_ARRAY_BUFFER, staging.size() * sizeof(ColorVertex),
+                             staging.data(), GL_STREAM_DRAW);
+            drawArrays(nullptr, 0);
+            glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        } else {
+            drawArrays(staging.data(), 0);
+        }
+    }
+    
+    void writeVertices(ColorVertex* out) {
+        for(const QueuedCloud& c : queued) {
+            for(int p = 0; p < PUFF_COUNT; p++) {
+                float cx = c.x + c.size * PUFFS[p][0];
+                float cy = c.y + c.size * PUFFS[p][1];
+                float r = c.size * PUFFS[p][2];
+                int segments = CircleLibrary::segmentsFor(r);
+                const float* unit = CircleLibrary::unitCircle(segments);
+                
+                for(int i = 0; i < segments; i++) {
+                    int next = (i + 1) < segments ? i + 1 : 0;
+                    *out++ = {cx, cy, 1.0f, 1.0f, 1.0f};
+                    *out++ = {cx + r * unit[2 * i], cy + r * unit[2 * i + 1], 1.0f, 1.0f, 1.0f};
+                    *out++ = {cx + r * unit[2 * next], cy + r * unit[2 * next + 1], 1.0f, 1.0f, 1.0f};
+                }
+            }
+        }
+    }
+    
+    void drawArrays(const ColorVertex* base, size_t first) {
+        const char* ptr = reinterpret_cast<const char*>(base);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(ColorVertex), ptr);
+        glColorPointer(3, GL_FLOAT, sizeof(ColorVertex), ptr + 2 * sizeof(float));
+        glDrawArrays(GL_TRIANGLES, static_cast<GLint>(first), static_cast<GLsizei>(queuedVertices));
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    
+    // Grow the ring; only happens when the cloud count outgrows it
+    void reserve(size_t vertices) {
+        release();
+        regionCapacity = max(vertices, static_cast<size_t>(4096));
+        
+        GLsizeiptr bytes = REGIONS * regionCapacity * sizeof(ColorVertex);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glExt.genBuffers(1, &buffer);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glExt.bufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+        mapped = static_cast<ColorVertex*>(glExt.mapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    void release() {
+        if(!buffer) return;
+        for(int i = 0; i < REGIONS; i++) {
+            if(fences[i]) {
+                glExt.clientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                glExt.deleteSync(fences[i]);
+                fences[i] = nullptr;
+            }
+        }
+        if(mapped) {
+            glExt.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glExt.unmapBuffer(GL_ARRAY_BUFFER);
+            glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+            mapped = nullptr;
+        }
+        glExt.deleteBuffers(1, &buffer);
+        buffer = 0;
+        regionCapacity = 0;
+    }
+};
+
+const float CloudBatcher::PUFFS[CloudBatcher::PUFF_COUNT][3] = {
+    { 0.0f,  0.0f, 1.0f},
+    { 0.8f,  0.3f, 0.9f},
+    {-0.8f,  0.3f, 0.7f},
+    { 0.4f, -0.2f, 0.6f},
+    {-0.4f, -0.2f, 0.6f}
+};
+
+
+/**
+ * Draw order of the scene, back to front
+ */
+enum RenderLayer {
+    LAYER_CELESTIAL,
+    LAYER_CLOUDS,
+    LAYER_WINDMILLS,
+    LAYER_COUNT
+};
+
+
+/**
+ * @struct Material
+ * @brief Fixed-function state a command needs besides its vertex colours
+ */
+struct Material {
+    float lineWidth;
+    
+    Material(float width = 1.0f) : lineWidth(width) {}
+    
+    bool operator==(const Material& o) const { return lineWidth == o.lineWidth; }
+};
+
+
+/**
+ * @class RenderQueue
+ * @brief Collects draw commands for a frame, sorts them and issues minimal GL
+ *
+ * Entities append geometry commands (list primitives only: GL_TRIANGLES,
+ * GL_LINES, GL_POINTS) or feed the fleet and cloud batchers. flush() sorts
+ * by layer, primitive and material, copies the vertices into one stream in
+ * that order, merges neighbouring commands with identical state into a
+ * single draw and only touches GL state that actually changes.
+ */
+class RenderQueue {
+private:
+    struct Command {
+        unsigned long long key;   // layer | primitive | material | sequence
+        size_t first, count;      // Vertex range in the submission arena
+        RenderBatch* batch;       // Set for batch commands
+    };
+    
+    vector<Command> commands;
+    vector<Material> materials;
+    vector<ColorVertex> submitted;
+    vector<ColorVertex> sorted;
+    RenderStats stats;
+    unsigned sequence = 0;   // Submission order within the frame, the last sort key
+    
+    FleetRenderer fleet;
+    CloudBatcher clouds;
+    
+    static const unsigned BATCH_PRIMITIVE = 0xFF;  // Batches sort after geometry in a layer
+    
+public:
+    void begin() {
+        commands.clear();
+        submitted.clear();
+        stats = RenderStats();
+        sequence = 0;
+        fleet.begin();
+        clouds.begin();
+    }
+    
+    // Opens a geometry command; following addVertex calls extend it
+    void startCommand(RenderLayer layer, GLenum primitive, const Material& material = Material()) {
+        Command c;
+        c.key = makeKey(layer, primitive & 0xFF, materialId(material));
+        c.first = submitted.size();
+        c.count = 0;
+        c.batch = nullptr;
+        commands.push_back(c);
+    }
+    
+    void addVertex(float px, float py, Color col) {
+        submitted.push_back({px, py, col.r, col.g, col.b});
+        commands.back().count++;
+    }
+    
+    FleetRenderer& getFleet() { return fleet; }
+    CloudBatcher& getClouds() { return clouds; }
+    
+    void flush(RenderBackend& backend) {
+        if(!fleet.empty()) submitBatch(LAYER_WINDMILLS, &fleet);
+        if(!clouds.empty()) submitBatch(LAYER_CLOUDS, &clouds);
+        stats.commands = static_cast<int>(commands.size());
+        
+        sort(commands.begin(), commands.end(),
+             [](const Command& a, const Command& b) { return a.key < b.key; });
+        
+        // Lay vertices out in sorted order so equal-state runs are contiguous
+        sorted.resize(submitted.size());
+        size_t offset = 0;
+        for(Command& c : commands) {
+            if(c.batch) continue;
+            copy(submitted.begin() + c.first, submitted.begin() + c.first + c.count,
+                 sorted.begin() + offset);
+            c.first = offset;
+            offset += c.count;
+        }
+        
+        if(backend.usesOpenGL()) {
+            drawGL();
+        } else {
+            drawTo(backend);
+        }
+    }
+    
+    const RenderStats& getStats() const { return stats; }
+    
+private:
+    // Other backends get the same merged runs, without GL state tracking
+    void drawTo(RenderBackend& backend) {
+        size_t i = 0;
+        while(i < commands.size()) {
+            const Command& c = commands[i];
+            if(c.batch) {
+                c.batch->emit(backend, stats);
+                i++;
+                continue;
+            }
+            
+            unsigned long long state = c.key >> 24;
+            size_t count = c.count;
+            size_t j = i + 1;
+            while(j < commands.size() && !commands[j].batch && (commands[j].key >> 24) == state) {
+                count += commands[j].count;
+                j++;
+            }
+            if(count > 0) {
+                GLenum primitive = static_cast<GLenum>((c.key >> 40) & 0xFF);
+                float lineWidth = materials[(c.key >> 24) & 0xFFFF].lineWidth;
+                backend.drawArrays(primitive, &sorted[c.first], count, lineWidth);
+                stats.drawCalls++;
+            }
+            i = j;
+        }
+    }
+    
+    void drawGL() {
+        bool arraysBound = false;
+        float lineWidth = 1.0f;
+        
+        size_t i = 0;
+        while(i < commands.size()) {
+            const Command& c = commands[i];
+            if(c.batch) {
+                if(arraysBound) unbindArrays();
+                arraysBound = false;
+                c.batch->render(stats);
+                i++;
+                continue;
+            }
+            
+            // Extend the run over every following command with the same state
+            unsigned long long state = c.key >> 24;
+            size_t count = c.count;
+            size_t j = i + 1;
+            while(j < commands.size() && !commands[j].batch && (commands[j].key >> 24) == state) {
+                count += commands[j].count;
+                j++;
+            }
+            
+            if(count > 0) {
+                if(!arraysBound) {
+                    bindArrays();
+                    arraysBound = true;
+                }
+                const Material& m = materials[(c.key >> 24) & 0xFFFF];
+                if(m.lineWidth != lineWidth) {
+                    glLineWidth(m.lineWidth);
+                    lineWidth = m.lineWidth;
+                    stats.stateChanges++;
+                }
+                GLenum primitive = static_cast<GLenum>((c.key >> 40) & 0xFF);
+                glDrawArrays(primitive, static_cast<GLint>(c.first), static_cast<GLsizei>(count));
+                stats.drawCalls++;
+            }
+            i = j;
+        }
+        
+        if(arraysBound) unbindArrays();
+        if(lineWidth != 1.0f) glLineWidth(1.0f);
+    }
+    
+    unsigned long long makeKey(unsigned layer, unsigned primitive, unsigned material) {
+        return (static_cast<unsigned long long>(layer & 0xFF) << 48)
+             | (static_cast<unsigned long long>(primitive & 0xFF) << 40)
+             | (static_cast<unsigned long long>(material & 0xFFFF) << 24)
+             | (sequence++ & 0xFFFFFF);
+    }
+    
+    unsigned materialId(const Material& m) {
+        for(size_t i = 0; i < materials.size(); i++) {
+            if(materials[i] == m) return static_cast<unsigned>(i);
+        }
+        materials.push_back(m);
+        return static_cast<unsigned>(materials.size() - 1);
+    }
+    
+    void submitBatch(RenderLayer layer, RenderBatch* batch) {
+        Command c;
+        c.key = makeKey(layer, BATCH_PRIMITIVE, 0);
+        c.first = 0;
+        c.count = 0;
+        c.batch = batch;
+        commands.push_back(c);
+    }
+    
+    void bindArrays() {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(ColorVertex), &sorted[0].x);
+        glColorPointer(3, GL_FLOAT, sizeof(ColorVertex), &sorted[0].r);
+        stats.stateChanges++;
+    }
+    
+    void unbindArrays() {
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+};
+
+
+/**
+ * @struct AlignedAllocator
+ * @brief Allocator for vectors whose data must start on a cache line
+ */
+template<typename T, size_t Align = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+    
+    AlignedAllocator() {}
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+    
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(Align)));
+    }
+    void deallocate(T* p, size_t) { ::operator delete(p, align_val_t(Align)); }
+    
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = vector<T, AlignedAllocator<T>>;
+
+
+/**
+ * @class RotorModel
+ * @brief Constants of the rotor dynamics and the torque coefficient table
+ *
+ * Cp(λ, pitch) comes from the usual analytic fit (Heier/Slootweg). The
+ * table holds Cq = Cp / λ, so aerodynamic torque is Cq * ½ρπR³v² and the
+ * kernel never divides by ω. The fit gives no torque at standstill, so a
+ * small starting torque that fades out by λ = 2 is added; otherwise a
+ * rotor at rest could never start.
+ */
+class RotorModel {
+public:
+    static constexpr float AIR_DENSITY = 1.225f;     // kg/m³
+    static constexpr float METERS_PER_UNIT = 0.5f;   // An 80-unit blade is 40 m
+    static constexpr float RATED_TIP_SPEED = 80.0f;  // m/s, sets the default rated speed
+    static constexpr float REFERENCE_RADIUS = 63.0f; // Inertia is scaled from a 63 m, 5 MW rotor
+    static constexpr float REFERENCE_INERTIA = 3.8e7f;
+    static constexpr float PITCH_GAIN = 80.0f;       // Degrees/s per rad/s of overspeed
+    static constexpr float MAX_PITCH_RATE = 8.0f;    // Degrees/s
+    static constexpr float MAX_PITCH = 45.0f;        // Degrees
+    static constexpr float START_CQ = 0.01f;
+    
+    static constexpr float LAMBDA_STEP = 0.25f;
+    static const int LAMBDA_COUNT = 65;              // λ from 0 to 16
+    static constexpr float PITCH_STEP = 2.0f;
+    static const int PITCH_COUNT = 24;               // 0 to 46 degrees
+    
+private:
+    float cq[PITCH_COUNT * LAMBDA_COUNT];   // Row per pitch
+    float cpMax;
+    float optimalLambda;
+    
+    RotorModel() : cpMax(0.0f), optimalLambda(1.0f) {
+        for(int p = 0; p < PITCH_COUNT; p++) {
+            for(int l = 0; l < LAMBDA_COUNT; l++) {
+                float lambda = l * LAMBDA_STEP;
+                float power = powerCoefficient(lambda, p * PITCH_STEP);
+                float start = START_CQ * max(0.0f, 1.0f - lambda / 2.0f);
+                cq[p * LAMBDA_COUNT + l] = (l > 0 ? power / lambda : 0.0f) + start;
+                if(p == 0 && power > cpMax) {
+                    cpMax = power;
+                    optimalLambda = lambda;
+                }
+            }
+        }
+    }
+    
+public:
+    static const RotorModel& instance() {
+        static RotorModel model;
+        return model;
+    }
+    
+    static float powerCoefficient(float lambda, float pitch) {
+        if(lambda <= 0.0f) return 0.0f;
+        float inverse = 1.0f / (lambda + 0.08f * pitch) - 0.035f / (pitch * pitch * pitch + 1.0f);
+        return 0.5176f * (116.0f * inverse - 0.4f * pitch - 5.0f) * expf(-21.0f * inverse)
+             + 0.0068f * lambda;
+    }
+    
+    const float* getTable() const { return cq; }
+    float getOptimalLambda() const { return optimalLambda; }
+    
+    // Generator torque gain that holds the rotor at the optimal λ: torque = gain * ω²
+    float optimalGain(float radius) const {
+        float r5 = radius * radius * radius * radius * radius;
+        return 0.5f * AIR_DENSITY * 3.14159265f * r5 * cpMax
+             / (optimalLambda * optimalLambda * optimalLambda);
+    }
+    
+    static float inertia(float radius) {
+        float scale = radius / REFERENCE_RADIUS;
+        return REFERENCE_INERTIA * scale * scale * scale * scale * scale;
+    }
+};
+
+
+/**
+ * @struct RotorColumns
+ * @brief Pointers to the rotor columns one dynamics kernel call works on
+ */
+struct RotorColumns {
+    float* omega;                // rad/s
+    float* pitch;                // Degrees
+    float* degreesPerStep;       // Output, for stepRotors
+    float* power;                // Output, electrical power in W
+    double* energy;              // Energy generated so far, J
+    const float* wind;           // Effective wind speed at the hub, m/s
+    const float* radius;         // m
+    const float* inertia;        // kg m²
+    const float* gain;           // Generator torque = gain * ω² up to rated
+    const float* rated;          // Rated rotor speed, rad/s
+    const float* spinning;       // 0 holds the rotor with the brake
+    
+    RotorColumns offset(size_t n) const {
+        return {omega + n, pitch + n, degreesPerStep + n, power + n, energy + n, wind + n,
+                radius + n, inertia + n, gain + n, rated + n, spinning + n};
+    }
+};
+
+
+/**
+ * @class CompactRotor
+ * @brief The shared rotor of compact windmills, in quantized units
+ *
+ * A compact windmill keeps a 16-bit blade phase, in which a full turn is
+ * 65536 so it wraps by integer overflow, and one byte of speed: the phase
+ * advance per step in units of PHASE_PER_CODE. Every compact windmill has
+ * the default 80-unit rotor and runs at its steady state (optimal tip
+ * speed ratio up to rated speed) instead of integrating the dynamics, so
+ * its power depends on the speed byte alone and comes from a table.
+ */
+class CompactRotor {
+public:
+    static const int PHASE_PER_CODE = 4;               // Up to about 56 rpm in a byte
+    static const int CODES = 256;
+    static const uint8_t SPINNING = 1;                 // Status bit; clear holds the rotor
+    static constexpr float BLADE_LENGTH = 80.0f;       // World units, addWindmill()'s default
+    static constexpr float POSITION_SCALE = 32.0f;     // Steps per world unit; ±1023 units fit
+    static constexpr float OMEGA_PER_CODE =
+        PHASE_PER_CODE / 65536.0f * 2.0f * 3.14159265f / static_cast<float>(SIMULATION_STEP);
+
+private:
+    float radius, rated, lambda;
+    double power[CODES];   // W at each speed code
+    
+    CompactRotor() {
+        const RotorModel& model = RotorModel::instance();
+        radius = BLADE_LENGTH * RotorModel::METERS_PER_UNIT;
+        rated = RotorModel::RATED_TIP_SPEED / radius;
+        lambda = model.getOptimalLambda();
+        float gain = model.optimalGain(radius);
+        for(int c = 0; c < CODES; c++) {
+            float omega = c * OMEGA_PER_CODE;
+            power[c] = static_cast<double>(gain * min(omega * omega, rated * rated) * omega);
+        }
+    }
+
+public:
+    static const CompactRotor& instance() {
+        static CompactRotor rotor;
+        return rotor;
+    }
+    
+    // Steady speed in this wind, rounded to a code
+    uint8_t speedCode(float wind) const {
+        float omega = min(lambda * max(wind, 0.0f) / radius, rated);
+        return static_cast<uint8_t>(min(static_cast<int>(omega / OMEGA_PER_CODE + 0.5f), CODES - 1));
+    }
+    
+    const double* getPowerTable() const { return power; }
+    
+    static int16_t quantize(float coordinate) {
+        float q = coordinate * POSITION_SCALE;
+        return static_cast<int16_t>(lrintf(min(max(q, -32768.0f), 32767.0f)));
+    }
+    static float position(int16_t q) { return q * (1.0f / POSITION_SCALE); }
+    static float degrees(uint16_t phase) { return phase * (360.0f / 65536.0f); }
+};
+
+
+/**
+ * @struct WindGrid
+ * @brief Read-only view of a wind field's current cells, for the sampling kernel
+ *
+ * Cells are the grid's vertices, row by row. The wind blows along +x
+ * everywhere, so a cell holds a speed in m/s.
+ */
+struct WindGrid {
+    const float* cells;
+    int columns, rows, stride;   // stride >= columns, in floats
+    float originX, originY;      // World position of cell (0, 0)
+    float inverseSpacing;        // Cells per world unit
+};
+
+
+// Clouds leaving past the right edge re-enter at the left
+const float CLOUD_EXIT_X = 450.0f;
+const float CLOUD_ENTRY_X = -450.0f;
+
+// Wind turbulence: octaves of value noise, in lattice units of the largest gusts
+const float WIND_GUST_SIZE = 240.0f;   // World units per lattice cell of the first octave
+const float WIND_TURBULENCE = 0.4f;    // Peak gusts, as a fraction of the mean wind
+const int WIND_OCTAVES = 3;
+const int WIND_PERIOD = 256;           // The lattice repeats after this many cells
+const int WIND_LATTICE_BIAS = 1 << 14; // Above any lattice coordinate the field uses
+
+// Turbine wakes: upstream turbines kept per turbine, and the largest combined deficit
+const int WAKE_SLOTS = 8;
+const float WAKE_MAX_DEFICIT = 0.8f;
+
+/**
+ * @struct SimdKernels
+ * @brief The bulk per-step kernels, one implementation per instruction set
+ *
+ * Every variant performs the same float operations in the same order as
+ * the scalar one, so they all give bit-identical results, which
+ * --verify-kernels checks. speed * spinning is exact (spinning is 0 or 1),
+ * so it does not matter if the compiler fuses it into an FMA. Wraps are
+ * done with compare masks, never branches. The best variant the CPU
+ * supports is picked at startup.
+ */
+struct SimdKernels {
+    const char* name;
+    // out[i] = turbulence factor (about 1 ± WIND_TURBULENCE) at lattice point
+    // (u + i * du, v) and time t of the noise picked by seed
+    void (*windNoise)(float* out, float u, float v, float du, float t, uint32_t seed, size_t n);
+    // out[i] = wind bilinearly sampled at (x[i], y[i]), times scale[i] unless
+    // scale is nullptr; positions outside the grid take the nearest edge
+    void (*sampleWind)(const WindGrid& grid, const float* x, const float* y,
+                       const float* scale, float* out, size_t n);
+    // wind[i] *= 1 - deficit, the deficits strength[source] * coupling of the
+    // WAKE_SLOTS upstream turbines combined as a root sum of squares. Slot k of
+    // turbine i is at k * stride + i.
+    void (*applyWake)(float* wind, const float* strength, const int* source,
+                      const float* coupling, size_t stride, size_t n);
+    // One step of the rotor dynamics; fills degreesPerStep for stepRotors
+    void (*integrateRotors)(const RotorColumns& columns, size_t n);
+    // angle += speed * spinning, wrapped into [0, 360); previous gets the old angle
+    void (*stepRotors)(float* angle, float* previous, const float* speed,
+                       const float* spinning, size_t n);
+    // x += speed; past CLOUD_EXIT_X it jumps to CLOUD_ENTRY_X and wrapped[i] = 1.
+    // previous gets the old x, or the entry point for a wrapped cloud.
+    // Returns the number of clouds that wrapped.
+    size_t (*stepClouds)(float* x, float* previous, const float* speed,
+                         unsigned char* wrapped, size_t n);
+    // out[i] = value counter + i of the random stream with this key, in [0, 1)
+    void (*randomUnit)(float* out, uint32_t key, uint32_t counter, size_t n);
+    // out[i] = standard normal value from values counter + 2i and counter + 2i + 1
+    void (*randomNormal)(float* out, uint32_t key, uint32_t counter, size_t n);
+    // Compact rotors: phase += speed * PHASE_PER_CODE where the spinning bit is
+    // set, wrapping at 65536; previous gets the old phase
+    void (*stepPhases)(uint16_t* phase, uint16_t* previous, const uint8_t* speed,
+                       const uint8_t* status, size_t n);
+};
+
+static void stepRotorsScalar(float* __restrict angle, float* __restrict previous,
+                             const float* __restrict speed, const float* __restrict spinning,
+                             size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        float next = angle[i] + speed[i] * spinning[i];
+        previous[i] = angle[i];
+        angle[i] = next - 360.0f * (next >= 360.0f);  // Arithmetic, not a branch
+    }
+}
+
+static size_t stepCloudsScalar(float* __restrict x, float* __restrict previous,
+                               const float* __restrict speed, unsigned char* __restrict wrapped,
+                               size_t n) {
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        float next = x[i] + speed[i];
+        bool wrap = next > CLOUD_EXIT_X;
+        previous[i] = wrap ? CLOUD_ENTRY_X : x[i];  // Jump rather than slide back across the sky
+        x[i] = wrap ? CLOUD_ENTRY_X : next;
+        wrapped[i] = wrap;
+        count += wrap;
+    }
+    return count;
+}
+
+// std::min() and std::max() return references, and GCC will not vectorise
+// an omp simd loop that takes references to its temporaries
+static inline __attribute__((always_inline))
+float minValue(float a, float b) { return b < a ? b : a; }
+
+static inline __attribute__((always_inline))
+float maxValue(float a, float b) { return a < b ? b : a; }
+
+// One explicit Euler step of the rotor dynamics: aerodynamic torque from the
+// Cq table (bilinear in λ and pitch), generator torque on the optimal-λ curve
+// capped at rated torque, and a rate-limited P pitch controller holding rated
+// speed. The generator's power is added to the turbine's energy in double,
+// so long runs do not lose small steps. Compiled once per instruction set;
+// the compiler vectorises the loop, with gathers for the table where the
+// target has them.
+static inline __attribute__((always_inline))
+void integrateRotorsBody(const RotorColumns& c, size_t n) {
+    const float dt = static_cast<float>(SIMULATION_STEP);
+    const float halfRhoPi = 0.5f * RotorModel::AIR_DENSITY * 3.14159265f;
+    const float toDegrees = dt * 180.0f / 3.14159265f;
+    const int LC = RotorModel::LAMBDA_COUNT;
+    const float* __restrict cq = RotorModel::instance().getTable();
+    float* __restrict omega = c.omega;
+    float* __restrict pitch = c.pitch;
+    float* __restrict out = c.degreesPerStep;
+    float* __restrict power = c.power;
+    double* __restrict energy = c.energy;
+    const float* __restrict wind = c.wind;
+    const float* __restrict radius = c.radius;
+    const float* __restrict inertia = c.inertia;
+    const float* __restrict gain = c.gain;
+    const float* __restrict rated = c.rated;
+    const float* __restrict spinning = c.spinning;
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        float w = omega[i];
+        float v = maxValue(wind[i], 0.1f);
+        float r = radius[i];
+        
+        float lf = minValue(w * r / v * (1.0f / RotorModel::LAMBDA_STEP), LC - 1.001f);
+        float pf = minValue(pitch[i] * (1.0f / RotorModel::PITCH_STEP), RotorModel::PITCH_COUNT - 1.001f);
+        int li = static_cast<int>(lf);
+        int pi = static_cast<int>(pf);
+        float lt = lf - li;
+        float pt = pf - pi;
+        int k = pi * LC + li;
+        float low = cq[k] + (cq[k + 1] - cq[k]) * lt;
+        float high = cq[k + LC] + (cq[k + LC + 1] - cq[k + LC]) * lt;
+        float coefficient = low + (high - low) * pt;
+        
+        float aero = halfRhoPi * r * r * r * v * v * coefficient;
+        float limit = rated[i];
+        float generator = gain[i] * minValue(w * w, limit * limit);
+        float next = maxValue(w + dt * (aero - generator) / inertia[i], 0.0f) * spinning[i];
+        
+        float rate = minValue(maxValue(RotorModel::PITCH_GAIN * (next - limit), -RotorModel::MAX_PITCH_RATE),
+                         RotorModel::MAX_PITCH_RATE);
+        pitch[i] = minValue(maxValue(pitch[i] + dt * rate, 0.0f), RotorModel::MAX_PITCH);
+        omega[i] = next;
+        out[i] = next * toDegrees;
+        power[i] = generator * w;
+        energy[i] += static_cast<double>(power[i]) * SIMULATION_STEP;
+    }
+}
+
+// Hash of a lattice point to [-1, 1); each octave has its own seed, and
+// coordinates wrap at mask + 1 so the noise tiles seamlessly
+static inline __attribute__((always_inline))
+float latticeValue(int x, int y, int t, int mask, uint32_t seed) {
+    uint32_t h = static_cast<uint32_t>(x & mask) * 0x8da6b343u
+               ^ static_cast<uint32_t>(y & mask) * 0xd8163841u
+               ^ static_cast<uint32_t>(t & mask) * 0xcb1ab31fu ^ seed;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return static_cast<int32_t>(h) * (1.0f / 2147483648.0f);
+}
+
+// Bilinear blend of the four lattice values around a point at one time
+static inline __attribute__((always_inline))
+float latticeSlice(int ix, int iy, int it, float ux, float uy, int mask, uint32_t seed) {
+    float c00 = latticeValue(ix, iy, it, mask, seed);
+    float c10 = latticeValue(ix + 1, iy, it, mask, seed);
+    float c01 = latticeValue(ix, iy + 1, it, mask, seed);
+    float c11 = latticeValue(ix + 1, iy + 1, it, mask, seed);
+    float low = c00 + (c10 - c00) * ux;
+    float high = c01 + (c11 - c01) * ux;
+    return low + (high - low) * uy;
+}
+
+// Smoothly interpolated lattice values in x, y and time. Coordinates stay
+// well inside ±WIND_LATTICE_BIAS, so a biased truncation is the floor and,
+// unlike floorf(), vectorises on every target.
+static inline __attribute__((always_inline))
+float valueNoise(float x, float y, float t, int mask, uint32_t seed) {
+    int ix = static_cast<int>(x + WIND_LATTICE_BIAS) - WIND_LATTICE_BIAS;
+    int iy = static_cast<int>(y + WIND_LATTICE_BIAS) - WIND_LATTICE_BIAS;
+    int it = static_cast<int>(t + WIND_LATTICE_BIAS) - WIND_LATTICE_BIAS;
+    float ux = x - ix, uy = y - iy, ut = t - it;
+    ux = ux * ux * (3.0f - 2.0f * ux);
+    uy = uy * uy * (3.0f - 2.0f * uy);
+    ut = ut * ut * (3.0f - 2.0f * ut);
+    
+    float before = latticeSlice(ix, iy, it, ux, uy, mask, seed);
+    float after = latticeSlice(ix, iy, it + 1, ux, uy, mask, seed);
+    return before + (after - before) * ut;
+}
+
+// Fractal sum of the octaves along one row of the wind grid
+static inline __attribute__((always_inline))
+void windNoiseBody(float* __restrict out, float u, float v, float du, float t, uint32_t seed, size_t n) {
+    const float norm = WIND_TURBULENCE / (2.0f - 2.0f / (1 << WIND_OCTAVES));
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        float x = u + static_cast<float>(static_cast<int>(i)) * du;   // Rows are short
+        float sum = 0.0f;
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+        #pragma GCC unroll 8
+        for(int octave = 0; octave < WIND_OCTAVES; octave++) {
+            sum += amplitude * valueNoise(x * frequency, v * frequency, t * frequency,
+                                          (WIND_PERIOD << octave) - 1, seed + octave * 0x9e3779b9u);
+            amplitude *= 0.5f;
+            frequency *= 2.0f;
+        }
+        out[i] = 1.0f + sum * norm;
+    }
+}
+
+// Wellons' lowbias32: a permutation of 32-bit values in which every input
+// bit affects every output bit
+static inline __attribute__((always_inline))
+uint32_t mixBits(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Value counter of the random stream with this key. Integer only, so every
+// target gives the same bits; the second round keeps streams whose keys
+// differ by a shift of the counter apart.
+static inline __attribute__((always_inline))
+uint32_t randomBits(uint32_t key, uint32_t counter) {
+    return mixBits(mixBits(counter + key) ^ key);
+}
+
+// The top 24 bits as a float in [0, 1), exactly
+static inline __attribute__((always_inline))
+float randomUnitValue(uint32_t bits) {
+    return static_cast<int>(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline __attribute__((always_inline))
+void randomUnitBody(float* __restrict out, uint32_t key, uint32_t counter, size_t n) {
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        out[i] = randomUnitValue(randomBits(key, counter + static_cast<uint32_t>(i)));
+    }
+}
+
+// ln(x) for normal x > 0: the exponent from the bits and a polynomial on
+// the mantissa (Cephes logf), within about 1 ulp. Selects, not branches,
+// so the loop vectorises; every target gives the same bits.
+static inline __attribute__((always_inline))
+float logValue(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    int exponent = static_cast<int>(bits >> 23) - 126;   // x = m * 2^exponent, m in [0.5, 1)
+    bits = (bits & 0x007fffffu) | 0x3f000000u;
+    float m;
+    memcpy(&m, &bits, sizeof m);
+    bool low = m < 0.70710678f;
+    exponent -= low;
+    m = (low ? m + m : m) - 1.0f;                        // In [sqrt(1/2) - 1, sqrt(2) - 1)
+    float z = m * m;
+    float y = ((((((((7.0376836292e-2f * m - 1.1514610310e-1f) * m + 1.1676998740e-1f) * m
+              - 1.2420140846e-1f) * m + 1.4249322787e-1f) * m - 1.6668057665e-1f) * m
+              + 2.0000714765e-1f) * m - 2.4999993993e-1f) * m + 3.3333331174e-1f) * m * z;
+    float e = static_cast<float>(exponent);
+    y += e * -2.12194440e-4f;
+    y += -0.5f * z;
+    return m + y + e * 0.693359375f;
+}
+
+// cos(2 pi v) for v in [0, 1): folded onto a quarter turn, then a Taylor
+// polynomial good to about 1e-7
+static inline __attribute__((always_inline))
+float cosTurnValue(float v) {
+    float a = fabsf(v - 0.5f);              // cos(2 pi v) = -cos(2 pi a), a in [0, 1/2]
+    bool far = a > 0.25f;
+    float b = far ? 0.5f - a : a;           // cos(2 pi a) = -cos(2 pi b) past a quarter turn
+    float t = 6.28318531f * b;
+    float z = t * t;
+    float c = 1.0f + z * (-0.5f + z * (4.16666667e-2f + z * (-1.38888889e-3f +
+              z * (2.48015873e-5f + z * (-2.75573192e-7f + z * 2.08767570e-9f)))));
+    return far ? c : -c;
+}
+
+// Box-Muller on two values of the stream; 1 - u is in (0, 1], so the
+// logarithm is finite
+static inline __attribute__((always_inline))
+void randomNormalBody(float* __restrict out, uint32_t key, uint32_t counter, size_t n) {
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        uint32_t c = counter + 2 * static_cast<uint32_t>(i);
+        float u = randomUnitValue(randomBits(key, c));
+        float v = randomUnitValue(randomBits(key, c + 1));
+        out[i] = sqrtf(-2.0f * logValue(1.0f - u)) * cosTurnValue(v);
+    }
+}
+
+// Integer only; uint16_t arithmetic wraps the phase for free
+static inline __attribute__((always_inline))
+void stepPhasesBody(uint16_t* __restrict phase, uint16_t* __restrict previous,
+                    const uint8_t* __restrict speed, const uint8_t* __restrict status, size_t n) {
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        int advance = speed[i] * CompactRotor::PHASE_PER_CODE * (status[i] & CompactRotor::SPINNING);
+        previous[i] = phase[i];
+        phase[i] = static_cast<uint16_t>(phase[i] + advance);
+    }
+}
+
+// Bilinear lookups into the grid; the compiler gathers where the target can
+template<bool SCALED>
+static inline __attribute__((always_inline))
+void sampleWindBody(const WindGrid& grid, const float* __restrict x, const float* __restrict y,
+                    const float* __restrict scale, float* __restrict out, size_t n) {
+    const float* __restrict cells = grid.cells;
+    const int stride = grid.stride;
+    const float maxX = grid.columns - 1.001f;
+    const float maxY = grid.rows - 1.001f;
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        float fx = min(max((x[i] - grid.originX) * grid.inverseSpacing, 0.0f), maxX);
+        float fy = min(max((y[i] - grid.originY) * grid.inverseSpacing, 0.0f), maxY);
+        int ix = static_cast<int>(fx);
+        int iy = static_cast<int>(fy);
+        float tx = fx - ix;
+        float ty = fy - iy;
+        int k = iy * stride + ix;
+        float low = cells[k] + (cells[k + 1] - cells[k]) * tx;
+        float high = cells[k + stride] + (cells[k + stride + 1] - cells[k + stride]) * tx;
+        float wind = low + (high - low) * ty;
+        out[i] = SCALED ? wind * scale[i] : wind;
+    }
+}
+
+// GCC otherwise fuses multiply-adds on targets with FMA, and the variants
+// would stop agreeing bit for bit
+#if defined(__GNUC__) && !defined(__clang__)
+#define KERNEL_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define KERNEL_NO_CONTRACT
+#endif
+
+// Root-sum-square of the upstream deficits; the source lookups are gathers
+static inline __attribute__((always_inline))
+void applyWakeBody(float* __restrict wind, const float* __restrict strength,
+                   const int* __restrict source, const float* __restrict coupling,
+                   size_t stride, size_t n) {
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        float sum = 0.0f;
+        #pragma GCC unroll 8
+        for(int k = 0; k < WAKE_SLOTS; k++) {
+            float deficit = strength[source[k * stride + i]] * coupling[k * stride + i];
+            sum += deficit * deficit;
+        }
+        wind[i] *= 1.0f - minValue(sqrtf(sum), WAKE_MAX_DEFICIT);
+    }
+}
+
+KERNEL_NO_CONTRACT
+static void integrateRotorsScalar(const RotorColumns& columns, size_t n) {
+    integrateRotorsBody(columns, n);
+}
+
+KERNEL_NO_CONTRACT
+static void windNoiseScalar(float* out, float u, float v, float du, float t, uint32_t seed,
+                            size_t n) {
+    windNoiseBody(out, u, v, du, t, seed, n);
+}
+
+KERNEL_NO_CONTRACT
+static void sampleWindScalar(const WindGrid& grid, const float* x, const float* y,
+                             const float* scale, float* out, size_t n) {
+    if(scale) sampleWindBody<true>(grid, x, y, scale, out, n);
+    else sampleWindBody<false>(grid, x, y, scale, out, n);
+}
+
+KERNEL_NO_CONTRACT
+static void applyWakeScalar(float* wind, const float* strength, const int* source,
+                            const float* coupling, size_t stride, size_t n) {
+    applyWakeBody(wind, strength, source, coupling, stride, n);
+}
+
+KERNEL_NO_CONTRACT
+static void randomUnitScalar(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomUnitBody(out, key, counter, n);
+}
+
+KERNEL_NO_CONTRACT
+static void randomNormalScalar(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomNormalBody(out, key, counter, n);
+}
+
+static void stepPhasesScalar(uint16_t* phase, uint16_t* previous, const uint8_t* speed,
+                             const uint8_t* status, size_t n) {
+    stepPhasesBody(phase, previous, speed, status, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_DISPATCH_X86 1
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void integrateRotorsSSE2(const RotorColumns& columns, size_t n) {
+    integrateRotorsBody(columns, n);
+}
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void windNoiseSSE2(float* out, float u, float v, float du, float t, uint32_t seed,
+                          size_t n) {
+    windNoiseBody(out, u, v, du, t, seed, n);
+}
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void sampleWindSSE2(const WindGrid& grid, const float* x, const float* y,
+                           const float* scale, float* out, size_t n) {
+    if(scale) sampleWindBody<true>(grid, x, y, scale, out, n);
+    else sampleWindBody<false>(grid, x, y, scale, out, n);
+}
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void applyWakeSSE2(float* wind, const float* strength, const int* source,
+                          const float* coupling, size_t stride, size_t n) {
+    applyWakeBody(wind, strength, source, coupling, stride, n);
+}
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void randomUnitSSE2(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomUnitBody(out, key, counter, n);
+}
+
+__attribute__((target("sse2"))) KERNEL_NO_CONTRACT
+static void randomNormalSSE2(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomNormalBody(out, key, counter, n);
+}
+
+__attribute__((target("sse2")))
+static void stepPhasesSSE2(uint16_t* phase, uint16_t* previous, const uint8_t* speed,
+                           const uint8_t* status, size_t n) {
+    stepPhasesBody(phase, previous, speed, status, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void integrateRotorsAVX2(const RotorColumns& columns, size_t n) {
+    integrateRotorsBody(columns, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void windNoiseAVX2(float* out, float u, float v, float du, float t, uint32_t seed,
+                          size_t n) {
+    windNoiseBody(out, u, v, du, t, seed, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void sampleWindAVX2(const WindGrid& grid, const float* x, const float* y,
+                           const float* scale, float* out, size_t n) {
+    if(scale) sampleWindBody<true>(grid, x, y, scale, out, n);
+    else sampleWindBody<false>(grid, x, y, scale, out, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void applyWakeAVX2(float* wind, const float* strength, const int* source,
+                          const float* coupling, size_t stride, size_t n) {
+    applyWakeBody(wind, strength, source, coupling, stride, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void randomUnitAVX2(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomUnitBody(out, key, counter, n);
+}
+
+__attribute__((target("avx2"))) KERNEL_NO_CONTRACT
+static void randomNormalAVX2(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomNormalBody(out, key, counter, n);
+}
+
+__attribute__((target("avx2")))
+static void stepPhasesAVX2(uint16_t* phase, uint16_t* previous, const uint8_t* speed,
+                           const uint8_t* status, size_t n) {
+    stepPhasesBody(phase, previous, speed, status, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void integrateRotorsAVX512(const RotorColumns& columns, size_t n) {
+    integrateRotorsBody(columns, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void windNoiseAVX512(float* out, float u, float v, float du, float t, uint32_t seed,
+                            size_t n) {
+    windNoiseBody(out, u, v, du, t, seed, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void sampleWindAVX512(const WindGrid& grid, const float* x, const float* y,
+                             const float* scale, float* out, size_t n) {
+    if(scale) sampleWindBody<true>(grid, x, y, scale, out, n);
+    else sampleWindBody<false>(grid, x, y, scale, out, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void applyWakeAVX512(float* wind, const float* strength, const int* source,
+                            const float* coupling, size_t stride, size_t n) {
+    applyWakeBody(wind, strength, source, coupling, stride, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void randomUnitAVX512(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomUnitBody(out, key, counter, n);
+}
+
+__attribute__((target("avx512f"))) KERNEL_NO_CONTRACT
+static void randomNormalAVX512(float* out, uint32_t key, uint32_t counter, size_t n) {
+    randomNormalBody(out, key, counter, n);
+}
+
+__attribute__((target("avx512f")))
+static void stepPhasesAVX512(uint16_t* phase, uint16_t* previous, const uint8_t* speed,
+                             const uint8_t* status, size_t n) {
+    stepPhasesBody(phase, previous, speed, status, n);
+}
+
+__attribute__((target("sse2")))
+static void stepRotorsSSE2(float* angle, float* previous, const float* speed,
+                           const float* spinning, size_t n) {
+    const __m128 full = _mm_set1_ps(360.0f);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(angle + i);
+        __m128 next = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(speed + i), _mm_loadu_ps(spinning + i)));
+        _mm_storeu_ps(previous + i, a);
+        // The compare mask keeps 360 only in lanes that passed it
+        _mm_storeu_ps(angle + i, _mm_sub_ps(next, _mm_and_ps(_mm_cmpge_ps(next, full), full)));
+    }
+    stepRotorsScalar(angle + i, previous + i, speed + i, spinning + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t stepCloudsSSE2(float* x, float* previous, const float* speed,
+                             unsigned char* wrapped, size_t n) {
+    const __m128 exitX = _mm_set1_ps(CLOUD_EXIT_X);
+    const __m128 entryX = _mm_set1_ps(CLOUD_ENTRY_X);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 old = _mm_loadu_ps(x + i);
+        __m128 next = _mm_add_ps(old, _mm_loadu_ps(speed + i));
+        __m128 wrap = _mm_cmpgt_ps(next, exitX);
+        _mm_storeu_ps(previous + i, _mm_or_ps(_mm_and_ps(wrap, entryX), _mm_andnot_ps(wrap, old)));
+        _mm_storeu_ps(x + i, _mm_or_ps(_mm_and_ps(wrap, entryX), _mm_andnot_ps(wrap, next)));
+        unsigned bits = _mm_movemask_ps(wrap);
+        for(int k = 0; k < 4; k++) wrapped[i + k] = (bits >> k) & 1;
+        count += __builtin_popcount(bits);
+    }
+    return count + stepCloudsScalar(x + i, previous + i, speed + i, wrapped + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void stepRotorsAVX2(float* angle, float* previous, const float* speed,
+                           const float* spinning, size_t n) {
+    const __m256 full = _mm256_set1_ps(360.0f);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(angle + i);
+        __m256 next = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(speed + i),
+                                                     _mm256_loadu_ps(spinning + i)));
+        _mm256_storeu_ps(previous + i, a);
+        __m256 wrap = _mm256_cmp_ps(next, full, _CMP_GE_OQ);
+        _mm256_storeu_ps(angle + i, _mm256_sub_ps(next, _mm256_and_ps(wrap, full)));
+    }
+    stepRotorsScalar(angle + i, previous + i, speed + i, spinning + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t stepCloudsAVX2(float* x, float* previous, const float* speed,
+                             unsigned char* wrapped, size_t n) {
+    const __m256 exitX = _mm256_set1_ps(CLOUD_EXIT_X);
+    const __m256 entryX = _mm256_set1_ps(CLOUD_ENTRY_X);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 old = _mm256_loadu_ps(x + i);
+        __m256 next = _mm256_add_ps(old, _mm256_loadu_ps(speed + i));
+        __m256 wrap = _mm256_cmp_ps(next, exitX, _CMP_GT_OQ);
+        _mm256_storeu_ps(previous + i, _mm256_blendv_ps(old, entryX, wrap));
+        _mm256_storeu_ps(x + i, _mm256_blendv_ps(next, entryX, wrap));
+        unsigned bits = _mm256_movemask_ps(wrap);
+        for(int k = 0; k < 8; k++) wrapped[i + k] = (bits >> k) & 1;
+        count += __builtin_popcount(bits);
+    }
+    return count + stepCloudsScalar(x + i, previous + i, speed + i, wrapped + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void stepRotorsAVX512(float* angle, float* previous, const float* speed,
+                             const float* spinning, size_t n) {
+    const __m512 full = _mm512_set1_ps(360.0f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512 a = _mm512_loadu_ps(angle + i);
+        __m512 next = _mm512_add_ps(a, _mm512_mul_ps(_mm512_loadu_ps(speed + i),
+                                                     _mm512_loadu_ps(spinning + i)));
+        _mm512_storeu_ps(previous + i, a);
+        __mmask16 wrap = _mm512_cmp_ps_mask(next, full, _CMP_GE_OQ);
+        _mm512_storeu_ps(angle + i, _mm512_mask_sub_ps(next, wrap, next, full));
+    }
+    stepRotorsScalar(angle + i, previous + i, speed + i, spinning + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static size_t stepCloudsAVX512(float* x, float* previous, const float* speed,
+                               unsigned char* wrapped, size_t n) {
+    const __m512 exitX = _mm512_set1_ps(CLOUD_EXIT_X);
+    const __m512 entryX = _mm512_set1_ps(CLOUD_ENTRY_X);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512 old = _mm512_loadu_ps(x + i);
+        __m512 next = _mm512_add_ps(old, _mm512_loadu_ps(speed + i));
+        __mmask16 wrap = _mm512_cmp_ps_mask(next, exitX, _CMP_GT_OQ);
+        _mm512_storeu_ps(previous + i, _mm512_mask_blend_ps(wrap, old, entryX));
+        _mm512_storeu_ps(x + i, _mm512_mask_blend_ps(wrap, next, entryX));
+        unsigned bits = wrap;
+        for(int k = 0; k < 16; k++) wrapped[i + k] = (bits >> k) & 1;
+        count += __builtin_popcount(bits);
+    }
+    return count + stepCloudsScalar(x + i, previous + i, speed + i, wrapped + i, n - i);
+}
+#endif
+
+// Every variant built into this binary, widest last
+const SimdKernels SIMD_VARIANTS[] = {
+    {"scalar", windNoiseScalar, sampleWindScalar, applyWakeScalar, integrateRotorsScalar,
+     stepRotorsScalar, stepCloudsScalar, randomUnitScalar,
+     randomNormalScalar, stepPhasesScalar},
+#ifdef SIMD_DISPATCH_X86
+    {"sse2", windNoiseSSE2, sampleWindSSE2, applyWakeSSE2, integrateRotorsSSE2,
+     stepRotorsSSE2, stepCloudsSSE2, randomUnitSSE2,
+     randomNormalSSE2, stepPhasesSSE2},
+    {"avx2", windNoiseAVX2, sampleWindAVX2, applyWakeAVX2, integrateRotorsAVX2,
+     stepRotorsAVX2, stepCloudsAVX2, randomUnitAVX2,
+     randomNormalAVX2, stepPhasesAVX2},
+    {"avx512", windNoiseAVX512, sampleWindAVX512, applyWakeAVX512, integrateRotorsAVX512,
+     stepRotorsAVX512, stepCloudsAVX512, randomUnitAVX512,
+     randomNormalAVX512, stepPhasesAVX512},
+#endif
+};
+const int SIMD_VARIANT_COUNT = sizeof(SIMD_VARIANTS) / sizeof(SIMD_VARIANTS[0]);
+
+// Whether this CPU (and OS) can run a variant
+bool simdSupported(const SimdKernels& kernels) {
+#ifdef SIMD_DISPATCH_X86
+    __builtin_cpu_init();
+    string name = kernels.name;
+    if(name == "sse2") return __builtin_cpu_supports("sse2");
+    if(name == "avx2") return __builtin_cpu_supports("avx2");
+    if(name == "avx512") return __builtin_cpu_supports("avx512f");
+#endif
+    return string(kernels.name) == "scalar";
+}
+
+// Widest supported variant; falls back to scalar
+const SimdKernels* bestSimdKernels() {
+    for(int i = SIMD_VARIANT_COUNT - 1; i > 0; i--) {
+        if(simdSupported(SIMD_VARIANTS[i])) return &SIMD_VARIANTS[i];
+    }
+    return &SIMD_VARIANTS[0];
+}
+
+// nullptr if unknown or unsupported here
+const SimdKernels* findSimdKernels(const string& name) {
+    for(int i = 0; i < SIMD_VARIANT_COUNT; i++) {
+        if(name == SIMD_VARIANTS[i].name) {
+            return simdSupported(SIMD_VARIANTS[i]) ? &SIMD_VARIANTS[i] : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// Kernels used by the stores; chosen once from CPUID, --simd overrides
+const SimdKernels* simdKernels = bestSimdKernels();
+
+
+/**
+ * @class Random
+ * @brief Counter-based random numbers from one explicit seed
+ *
+ * Value n of stream s is a hash of (seed, s, n); nothing is carried from
+ * one value to the next. Threads and entities each draw from their own
+ * stream without locks, and no result depends on which thread drew it or
+ * when. The same seed repeats a run bit for bit.
+ */
+class Random {
+public:
+    // Stream families in bits 32-39; the low 32 bits of a stream are free
+    // for an index and the bits above the family for an epoch
+    static const uint64_t WIND_STREAM = uint64_t(1) << 32;
+    static const uint64_t SPAWN_STREAM = uint64_t(2) << 32;
+    static const uint64_t CLOUD_STREAMS = uint64_t(3) << 32;    // + entity slot, epoch: high word of the step
+    static const int EPOCH_SHIFT = 40;
+
+private:
+    uint32_t seed;
+
+public:
+    explicit Random(uint32_t s) : seed(s) {}
+    
+    uint32_t getSeed() const { return seed; }
+    
+    // Neighbouring streams get unrelated keys
+    uint32_t key(uint64_t stream) const {
+        return mixBits(static_cast<uint32_t>(stream) ^
+                       mixBits(static_cast<uint32_t>(stream >> 32) ^ mixBits(seed)));
+    }
+    
+    // Value counter of a stream, in [low, high)
+    float uniform(uint64_t stream, uint32_t counter, float low, float high) const {
+        return low + (high - low) * randomUnitValue(randomBits(key(stream), counter));
+    }
+};
+
+
+/**
+ * @class RandomStream
+ * @brief Draws the values of one stream in order
+ *
+ * Single values and batches give the same sequence: a batch is the same
+ * float arithmetic on values made by the randomUnit and randomNormal
+ * kernels. A normal value takes two values of the stream.
+ */
+class RandomStream {
+private:
+    uint32_t key;
+    uint32_t counter;   // Next value
+
+public:
+    RandomStream(const Random& random, uint64_t stream, uint32_t next = 0)
+        : key(random.key(stream)), counter(next) {}
+    
+    uint32_t getCounter() const { return counter; }
+    
+    float uniform(float low, float high) {
+        return low + (high - low) * randomUnitValue(randomBits(key, counter++));
+    }
+    
+    // The next n uniform values
+    void fillUniform(float* out, size_t n, float low, float high) {
+        simdKernels->randomUnit(out, key, counter, n);
+        counter += static_cast<uint32_t>(n);
+        float range = high - low;
+        #pragma omp simd
+        for(size_t i = 0; i < n; i++) out[i] = low + range * out[i];
+    }
+    
+    float normal(float mean, float deviation) {
+        float value;
+        simdKernels->randomNormal(&value, key, counter, 1);
+        counter += 2;
+        return mean + deviation * value;
+    }
+    
+    // The next n normal values, for Monte Carlo sampling
+    void fillNormal(float* out, size_t n, float mean, float deviation) {
+        simdKernels->randomNormal(out, key, counter, n);
+        counter += static_cast<uint32_t>(2 * n);
+        #pragma omp simd
+        for(size_t i = 0; i < n; i++) out[i] = mean + deviation * out[i];
+    }
+};
+
+
+/**
+ * @class MappedFile
+ * @brief A whole file in memory, copy-on-write
+ *
+ * Mapped where the OS allows it, so pages are only read when touched;
+ * elsewhere the file is read into an aligned block. Either way the
+ * contents may be changed in place and the changes never reach the file.
+ */
+class MappedFile {
+private:
+    unsigned char* bytes;
+    size_t length;
+#ifdef SNAPSHOT_MMAP
+    dev_t device;   // Identify the mapped file, whatever path names it
+    ino_t inode;
+#endif
+
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+    ~MappedFile() { close(); }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    bool open(const string& path) {
+        close();
+#ifdef SNAPSHOT_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void* memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);   // The mapping keeps the file open
+        if(memory == MAP_FAILED) return false;
+        bytes = static_cast<unsigned char*>(memory);
+        length = info.st_size;
+        device = info.st_dev;
+        inode = info.st_ino;
+        return true;
+#else
+        FILE* file = fopen(path.c_str(), "rb");
+        if(!file) return false;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if(size > 0) {
+            bytes = static_cast<unsigned char*>(::operator new(size, align_val_t(64)));
+            length = size;
+            if(fread(bytes, 1, length, file) != length) close();
+        }
+        fclose(file);
+        return bytes != nullptr;
+#endif
+    }
+    
+    void close() {
+        if(!bytes) return;
+#ifdef SNAPSHOT_MMAP
+        munmap(bytes, length);
+#else
+        ::operator delete(bytes, align_val_t(64));
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+    
+    unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+    
+    bool holds(const void* p) const {
+        const unsigned char* at = static_cast<const unsigned char*>(p);
+        return at >= bytes && at < bytes + length;
+    }
+    
+    // Whether path names the mapped file; a file read into memory no longer
+    // depends on it
+    bool maps(const string& path) const {
+#ifdef SNAPSHOT_MMAP
+        struct stat info;
+        return bytes && stat(path.c_str(), &info) == 0 && info.st_dev == device && info.st_ino == inode;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+};
+
+
+// Kinds of snapshot section; the archetype mask tells rows of different
+// archetypes apart
+enum SnapshotSectionType {
+    SECTION_SCENE = 1,     // SceneRecord
+    SECTION_WIND = 2,      // WindField state and grids
+    SECTION_WAKE = 3,      // Wake links, if they were current
+    SECTION_ROWS = 4,      // An archetype's chunks, byte for byte as in memory
+    SECTION_HANDLES = 5,   // An archetype's handle table
+};
+
+struct SnapshotHeader {
+    char magic[8];            // "WINDSNAP"
+    uint32_t version;
+    uint32_t byteOrder;       // 0x01020304 as the writer stored it
+    uint64_t layout;          // Hash of the column table and chunk size
+    uint64_t sectionTable;    // File offset of the SnapshotSection array
+    uint32_t sectionCount;
+    uint32_t reserved;
+    unsigned char padding[24];
+};
+
+struct SnapshotSection {
+    uint32_t type;
+    uint32_t mask;            // Archetype components, 0 for scene-wide sections
+    uint64_t offset;          // From the start of the file, a multiple of ALIGN
+    uint64_t bytes;
+    uint64_t count;           // Rows, slots or cells, by type
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "the header is one cache line");
+
+/**
+ * @struct SnapshotFormat
+ * @brief Constants shared by the snapshot writer and reader
+ *
+ * A snapshot is a header, sections that each start on a cache line, and
+ * a table of the sections at the end. Rows are stored as whole chunks in
+ * their in-memory layout, so loading maps the file and points the chunks
+ * at it, with no parsing or copying. The layout hash, supplied by the
+ * world, refuses snapshots from builds whose columns differ; VERSION
+ * changes with anything else.
+ */
+struct SnapshotFormat {
+    static const uint32_t VERSION = 2;
+    static const uint32_t ENDIAN_MARK = 0x01020304u;
+    static const size_t ALIGN = 64;
+};
+
+
+/**
+ * @class SnapshotWriter
+ * @brief Streams sections to a file, then the section table and header
+ *
+ * Everything goes to path.tmp, which replaces path only once it is
+ * complete: a failed save leaves the old snapshot as it was, and a
+ * mapping of the old file is never truncated underneath its reader.
+ */
+class SnapshotWriter {
+private:
+    FILE* file;
+    string target;
+    string temporary;
+    uint64_t layout;
+    uint64_t position;
+    vector<SnapshotSection> sections;
+    bool failed;
+
+public:
+    SnapshotWriter() : file(nullptr), layout(0), position(0), failed(false) {}
+    ~SnapshotWriter() {
+        if(!file) return;
+        fclose(file);
+        remove(temporary.c_str());   // Abandoned before finish()
+    }
+    
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+    
+    bool open(const string& path, uint64_t columnLayout) {
+        layout = columnLayout;
+        target = path;
+        temporary = path + ".tmp";
+        file = fopen(temporary.c_str(), "wb");
+        if(!file) return false;
+        SnapshotHeader placeholder = {};
+        write(&placeholder, sizeof placeholder);
+        return !failed;
+    }
+    
+    void beginSection(uint32_t type, uint32_t mask, uint64_t count) {
+        pad();
+        sections.push_back({type, mask, position, 0, count});
+    }
+    
+    void write(const void* data, size_t bytes) {
+        if(bytes > 0 && fwrite(data, 1, bytes, file) != bytes) failed = true;
+        position += bytes;
+    }
+    
+    template<typename T>
+    void writeValue(const T& value) { write(&value, sizeof value); }
+    
+    void endSection() { sections.back().bytes = position - sections.back().offset; }
+    
+    // Table and header; false if anything failed to write
+    bool finish() {
+        pad();
+        SnapshotHeader header = {};
+        memcpy(header.magic, "WINDSNAP", 8);
+        header.version = SnapshotFormat::VERSION;
+        header.byteOrder = SnapshotFormat::ENDIAN_MARK;
+        header.layout = layout;
+        header.sectionTable = position;
+        header.sectionCount = static_cast<uint32_t>(sections.size());
+        write(sections.data(), sections.size() * sizeof(SnapshotSection));
+        if(fseek(file, 0, SEEK_SET) != 0) failed = true;
+        write(&header, sizeof header);
+        if(fclose(file) != 0) failed = true;
+        file = nullptr;
+#ifndef SNAPSHOT_MMAP
+        if(!failed) remove(target.c_str());   // rename() does not replace files everywhere
+#endif
+        if(failed || rename(temporary.c_str(), target.c_str()) != 0) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void pad() {
+        static const unsigned char zeros[SnapshotFormat::ALIGN] = {};
+        write(zeros, (SnapshotFormat::ALIGN - position % SnapshotFormat::ALIGN) % SnapshotFormat::ALIGN);
+    }
+};
+
+
+/**
+ * @class Snapshot
+ * @brief A mapped snapshot file whose sections are used in place
+ */
+class Snapshot {
+private:
+    MappedFile file;
+    const SnapshotSection* sections;
+    uint32_t sectionCount;
+
+public:
+    Snapshot() : sections(nullptr), sectionCount(0) {}
+    
+    // Maps and checks the file; prints why it cannot be used
+    bool open(const string& path, uint64_t columnLayout) {
+        if(!file.open(path)) return fail(path, "cannot be read");
+        if(file.size() < sizeof(SnapshotHeader)) return fail(path, "is too short");
+        const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(file.data());
+        if(memcmp(header.magic, "WINDSNAP", 8) != 0) return fail(path, "is not a snapshot");
+        if(header.byteOrder != SnapshotFormat::ENDIAN_MARK) return fail(path, "has the wrong byte order");
+        if(header.version != SnapshotFormat::VERSION) return fail(path, "has an unsupported version");
+        if(header.layout != columnLayout) return fail(path, "has a different column layout");
+        uint64_t tableBytes = uint64_t(header.sectionCount) * sizeof(SnapshotSection);
+        if(header.sectionTable % SnapshotFormat::ALIGN != 0 || header.sectionTable > file.size() ||
+           tableBytes > file.size() - header.sectionTable) {
+            return fail(path, "has a damaged section table");
+        }
+        sections = reinterpret_cast<const SnapshotSection*>(file.data() + header.sectionTable);
+        sectionCount = header.sectionCount;
+        for(uint32_t i = 0; i < sectionCount; i++) {
+            const SnapshotSection& s = sections[i];
+            if(s.offset % SnapshotFormat::ALIGN != 0 || s.offset > file.size() ||
+               s.bytes > file.size() - s.offset) {
+                return fail(path, "has a section outside the file");
+            }
+        }
+        return true;
+    }
+    
+    uint32_t getSectionCount() const { return sectionCount; }
+    const SnapshotSection& section(uint32_t i) const { return sections[i]; }
+    
+    // nullptr if there is no such section
+    const SnapshotSection* find(uint32_t type, uint32_t mask) const {
+        for(uint32_t i = 0; i < sectionCount; i++) {
+            if(sections[i].type == type && sections[i].mask == mask) return &sections[i];
+        }
+        return nullptr;
+    }
+    
+    // Writable, copy-on-write
+    unsigned char* data(const SnapshotSection& s) const { return file.data() + s.offset; }
+    
+    bool holds(const void* p) const { return file.holds(p); }
+    bool maps(const string& path) const { return file.maps(path); }
+
+private:
+    bool fail(const string& path, const char* reason) {
+        cerr << "Snapshot " << path << " " << reason << endl;
+        file.close();
+        return false;
+    }
+};
+
+
+/**
+ * @class SectionReader
+ * @brief Copies a section out front to back; false once it runs short
+ */
+class SectionReader {
+private:
+    const unsigned char* at;
+    const unsigned char* end;
+
+public:
+    SectionReader(const Snapshot& snapshot, const SnapshotSection& s)
+        : at(snapshot.data(s)), end(snapshot.data(s) + s.bytes) {}
+    
+    bool read(void* to, size_t bytes) {
+        if(bytes > static_cast<size_t>(end - at)) return false;
+        if(bytes > 0) memcpy(to, at, bytes);
+        at += bytes;
+        return true;
+    }
+    
+    template<typename T>
+    bool readValue(T& value) { return read(&value, sizeof value); }
+};
+
+
+/**
+ * @class WindField
+ * @brief Turbulent wind over the world on a grid, sampled bilinearly
+ *
+ * The wind blows along +x with a mean of windSpeed. Turbulence is value
+ * noise in space and time that drifts downwind with the mean flow, so
+ * gusts travel across the farm. The noise is only evaluated at keyframes
+ * KEYFRAME_STEPS apart: the keyframe after next is built a few rows per
+ * step, and each step the current grid is blended between the two
+ * keyframes around it. A step never regenerates the whole field.
+ */
+class WindField {
+public:
+    static constexpr float SPACING = 8.0f;            // World units between cells
+    static const int KEYFRAME_STEPS = 30;             // Half a second
+    static constexpr double CORRELATION_TIME = 6.0;   // Seconds for a gust to change shape
+    static constexpr float REFERENCE_SPEED = 10.0f;   // m/s in which clouds drift at their nominal speed
+    
+private:
+    int columns, rows, stride;
+    float originX, originY;
+    AlignedVector<float> keys[3];   // Turbulence factors at keyframes k, k + 1, k + 2, cyclically
+    double drift[3];                // Downwind drift of each keyframe, lattice units
+    int older;                      // Slot of keyframe k
+    AlignedVector<float> current;   // m/s at the present step
+    long long step;                 // Steps since reset
+    uint32_t seed;                  // Picks the noise
+    
+    // Leads the snapshot section, before the grids
+    struct State {
+        int64_t step;
+        int32_t older;
+        uint32_t seed;
+        double drift[3];
+    };
+
+public:
+    explicit WindField(uint32_t noiseSeed)
+        : columns(static_cast<int>(WORLD_WIDTH / SPACING) + 1),
+          rows(static_cast<int>(ceilf(WORLD_HEIGHT / SPACING)) + 1),
+          stride((columns + 15) / 16 * 16),   // Rows start on a cache line
+          originX(-WORLD_WIDTH / 2), originY(-WORLD_HEIGHT / 2), seed(noiseSeed) {
+        for(AlignedVector<float>& key : keys) key.resize(stride * rows);
+        current.resize(stride * rows);
+        reset();
+    }
+    
+    // Back to the state at step 0
+    void reset() {
+        step = 0;
+        older = 0;
+        drift[0] = 0.0;
+        for(int k = 0; k < 3; k++) {
+            if(k > 0) drift[k] = nextDrift(drift[k - 1]);
+            buildRows(k, k, 0, rows);
+        }
+        blend(0.0f);
+    }
+    
+    // One simulation step: a slice of the next keyframe, then a new blend
+    void advance() {
+        step++;
+        int phase = static_cast<int>(step % KEYFRAME_STEPS);
+        int building = (older + 2) % 3;
+        if(phase == 0) {
+            int newer = building;
+            older = (older + 1) % 3;
+            building = (older + 2) % 3;
+            drift[building] = nextDrift(drift[newer]);
+        }
+        buildRows(building, step / KEYFRAME_STEPS + 2,
+                  rows * phase / KEYFRAME_STEPS, rows * (phase + 1) / KEYFRAME_STEPS);
+        blend(static_cast<float>(phase) / KEYFRAME_STEPS);
+    }
+    
+    WindGrid grid() const {
+        return {current.data(), columns, rows, stride, originX, originY, 1.0f / SPACING};
+    }
+    
+    // Wind at one point, m/s
+    float sample(float x, float y) const {
+        float wind;
+        simdKernels->sampleWind(grid(), &x, &y, nullptr, &wind, 1);
+        return wind;
+    }
+    
+    // Keyframes and blend, so a loaded field carries on mid-interval
+    void save(SnapshotWriter& out) const {
+        out.beginSection(SECTION_WIND, 0, current.size());
+        out.writeValue(State{step, older, seed, {drift[0], drift[1], drift[2]}});
+        for(const AlignedVector<float>& key : keys) out.write(key.data(), key.size() * sizeof(float));
+        out.write(current.data(), current.size() * sizeof(float));
+        out.endSection();
+    }
+    
+    // Whether the snapshot has a complete field of this size at a step and
+    // keyframe that advance() can carry on from
+    bool fits(const Snapshot& in) const {
+        const SnapshotSection* section = in.find(SECTION_WIND, 0);
+        State state;
+        return section && section->count == current.size() &&
+               section->bytes == sizeof(State) + 4 * current.size() * sizeof(float) &&
+               SectionReader(in, *section).readValue(state) &&
+               state.step >= 0 && state.older >= 0 && state.older < 3;
+    }
+    
+    // False, with the field unchanged, unless fits() accepts the snapshot
+    bool load(const Snapshot& in) {
+        if(!fits(in)) return false;
+        SectionReader reader(in, *in.find(SECTION_WIND, 0));
+        State state;
+        reader.readValue(state);
+        for(AlignedVector<float>& key : keys) reader.read(key.data(), key.size() * sizeof(float));
+        reader.read(current.data(), current.size() * sizeof(float));
+        step = state.step;
+        older = state.older;
+        seed = state.seed;
+        for(int k = 0; k < 3; k++) drift[k] = state.drift[k];
+        return true;
+    }
+
+private:
+    // Mean flow over one keyframe interval, wrapped with the noise lattice
+    static double nextDrift(double drift) {
+        double unitsPerKey = windSpeed / RotorModel::METERS_PER_UNIT * KEYFRAME_STEPS * SIMULATION_STEP;
+        return fmod(drift + unitsPerKey / WIND_GUST_SIZE, WIND_PERIOD);
+    }
+    
+    void buildRows(int slot, long long keyframe, int begin, int end) {
+        float t = static_cast<float>(fmod(keyframe * KEYFRAME_STEPS * SIMULATION_STEP / CORRELATION_TIME,
+                                          WIND_PERIOD));
+        float u = static_cast<float>(originX / WIND_GUST_SIZE - drift[slot]);
+        for(int r = begin; r < end; r++) {
+            float v = (originY + r * SPACING) / WIND_GUST_SIZE;
+            simdKernels->windNoise(&keys[slot][r * stride], u, v, SPACING / WIND_GUST_SIZE, t, seed, columns);
+        }
+    }
+    
+    // current = mean * lerp(keyframe k, keyframe k + 1, alpha)
+    void blend(float alpha) {
+        const float* a = keys[older].data();
+        const float* b = keys[(older + 1) % 3].data();
+        float* out = current.data();
+        float mean = windSpeed;
+        jobs.parallelFor(current.size(), [=](size_t begin, size_t end) {
+            #pragma omp simd
+            for(size_t i = begin; i < end; i++) out[i] = mean * (a[i] + (b[i] - a[i]) * alpha);
+        });
+    }
+};
+
+
+/**
+ * @class WakeModel
+ * @brief Jensen (Park) wakes: each turbine slows the wind behind it
+ *
+ * A wake widens linearly downwind; the deficit it causes falls with the
+ * square of its widening and scales with the part of the rotor it covers.
+ * Positions never change, so the geometric coupling to the WAKE_SLOTS
+ * strongest upstream turbines is found once, when turbines are added.
+ * Each step then only combines the upstream turbines' current thrust with
+ * these couplings, so its cost is linear in the number of turbines.
+ *
+ * Upstream turbines are found by a sweep along the wind: turbines are
+ * visited in order of x, and a few lateral bins remember the last
+ * turbines seen in them, i.e. the nearest upstream ones. Each turbine
+ * only tests those, never the whole farm.
+ */
+class WakeModel {
+public:
+    static constexpr float DECAY = 0.075f;              // Wake widening per unit of distance, onshore
+    static constexpr float THRUST_COEFFICIENT = 0.8f;   // Below rated, blades unpitched
+    static constexpr float FEATHER_PITCH = 90.0f;       // Thrust falls linearly to zero here
+    static constexpr float MAX_DIAMETERS = 20.0f;       // Wakes are ignored further downstream
+    static constexpr float BIN_METERS = 16.0f;          // Lateral size of a sweep bin
+    static const int BIN_DEPTH = 4;                     // Upstream turbines remembered per bin
+    
+private:
+    size_t count, stride;
+    AlignedVector<int> source;        // Slot k of turbine i at k * stride + i
+    AlignedVector<float> coupling;
+    AlignedVector<float> strength[2]; // 1 - sqrt(1 - Ct) per turbine: last step's and this step's
+    int current;                      // strength[current] is read this step
+    
+    // Leads the snapshot section, before the arrays
+    struct State {
+        uint64_t count;
+        uint64_t stride;
+        int32_t current;
+        int32_t reserved;
+    };
+
+public:
+    WakeModel() : count(0), stride(0), current(0) {}
+    
+    size_t size() const { return count; }
+    
+    // Links with a non-zero coupling, for reports
+    size_t getLinkCount() const {
+        size_t links = 0;
+        for(float c : coupling) links += c > 0.0f;
+        return links;
+    }
+    
+    // Finds the upstream turbines of every turbine. Positions are in world
+    // units, radius in m; pitch and spinning give the initial thrust.
+    void rebuild(const vector<float>& x, const vector<float>& y, const vector<float>& radius,
+                 const vector<float>& pitch, const vector<float>& spinning) {
+        count = x.size();
+        stride = (count + 15) / 16 * 16;
+        source.assign(WAKE_SLOTS * stride, 0);
+        coupling.assign(WAKE_SLOTS * stride, 0.0f);
+        for(int k = 0; k < WAKE_SLOTS; k++) {
+            for(size_t i = 0; i < count; i++) source[k * stride + i] = static_cast<int>(i);
+        }
+        for(AlignedVector<float>& s : strength) s.assign(stride, 0.0f);
+        current = 0;
+        updateThrust(pitch.data(), spinning.data(), 0, count);
+        current = 1;
+        updateThrust(pitch.data(), spinning.data(), 0, count);
+        if(count == 0) return;
+        
+        const float m = RotorModel::METERS_PER_UNIT;
+        vector<int> order(count);
+        for(size_t i = 0; i < count; i++) order[i] = static_cast<int>(i);
+        stable_sort(order.begin(), order.end(), [&x](int a, int b) { return x[a] < x[b]; });
+        
+        float minY = *min_element(y.begin(), y.end()) * m;
+        float maxY = *max_element(y.begin(), y.end()) * m;
+        float maxRadius = *max_element(radius.begin(), radius.end());
+        float reach = maxRadius + DECAY * 2.0f * maxRadius * MAX_DIAMETERS;
+        int bins = static_cast<int>((maxY - minY) / BIN_METERS) + 1;
+        vector<int> recent(bins * BIN_DEPTH, -1);
+        vector<int> next(bins, 0);
+        auto binOf = [&](float meters) {
+            return min(max(static_cast<int>((meters - minY) / BIN_METERS), 0), bins - 1);
+        };
+        
+        for(int i : order) {
+            float xi = x[i] * m, yi = y[i] * m, ri = radius[i];
+            int best[WAKE_SLOTS];
+            float strongest[WAKE_SLOTS] = {};
+            int found = 0;
+            for(int b = binOf(yi - ri - reach); b <= binOf(yi + ri + reach); b++) {
+                for(int d = 0; d < BIN_DEPTH; d++) {
+                    int j = recent[b * BIN_DEPTH + d];
+                    if(j < 0) continue;
+                    float c = couple(xi - x[j] * m, yi - y[j] * m, ri, radius[j]);
+                    if(c <= 0.0f) continue;
+                    // Keep the slots sorted, strongest first
+                    int at = min(found, WAKE_SLOTS - 1);
+                    if(found == WAKE_SLOTS && c <= strongest[at]) continue;
+                    for(; at > 0 && strongest[at - 1] < c; at--) {
+                        strongest[at] = strongest[at - 1];
+                        best[at] = best[at - 1];
+                    }
+                    strongest[at] = c;
+                    best[at] = j;
+                    found = min(found + 1, WAKE_SLOTS);
+                }
+            }
+            for(int k = 0; k < found; k++) {
+                source[k * stride + i] = best[k];
+                coupling[k * stride + i] = strongest[k];
+            }
+            
+            int b = binOf(yi);
+            recent[b * BIN_DEPTH + next[b]] = i;
+            next[b] = (next[b] + 1) % BIN_DEPTH;
+        }
+    }
+    
+    // Links and both thrust buffers, so a loaded farm needs no rebuild
+    void save(SnapshotWriter& out) const {
+        out.beginSection(SECTION_WAKE, 0, count);
+        out.writeValue(State{count, stride, current, 0});
+        out.write(source.data(), source.size() * sizeof(int));
+        out.write(coupling.data(), coupling.size() * sizeof(float));
+        for(const AlignedVector<float>& s : strength) out.write(s.data(), s.size() * sizeof(float));
+        out.endSection();
+    }
+    
+    // False, with the wakes unchanged, if the snapshot has no complete
+    // wakes for exactly turbines turbines or links one to a turbine
+    // outside them
+    bool load(const Snapshot& in, size_t turbines) {
+        const SnapshotSection* section = in.find(SECTION_WAKE, 0);
+        if(!section || section->count != turbines) return false;
+        SectionReader reader(in, *section);
+        State state;
+        size_t padded = (turbines + 15) / 16 * 16;
+        size_t bytes = sizeof(State) + padded * (WAKE_SLOTS * (sizeof(int) + sizeof(float)) + 2 * sizeof(float));
+        if(section->bytes != bytes || !reader.readValue(state) || state.count != turbines ||
+           state.stride != padded) {
+            return false;
+        }
+        
+        AlignedVector<int> links(WAKE_SLOTS * padded);
+        AlignedVector<float> weights(WAKE_SLOTS * padded);
+        AlignedVector<float> thrust[2] = {AlignedVector<float>(padded), AlignedVector<float>(padded)};
+        reader.read(links.data(), links.size() * sizeof(int));
+        reader.read(weights.data(), weights.size() * sizeof(float));
+        for(AlignedVector<float>& t : thrust) reader.read(t.data(), t.size() * sizeof(float));
+        // Padding lanes link to turbine 0, so every entry names a turbine
+        for(int j : links) {
+            if(static_cast<size_t>(j) >= turbines) return false;
+        }
+        
+        count = turbines;
+        stride = padded;
+        current = state.current & 1;
+        source.swap(links);
+        coupling.swap(weights);
+        for(int k = 0; k < 2; k++) strength[k].swap(thrust[k]);
+        return true;
+    }
+    
+    // Reduces the wind of turbines [first, first + n) by their wakes
+    void apply(float* wind, size_t first, size_t n) const {
+        simdKernels->applyWake(wind, strength[current].data(), source.data() + first,
+                               coupling.data() + first, stride, n);
+    }
+    
+    // This step's thrust of turbines [first, first + n), read by the next step
+    void updateThrust(const float* pitch, const float* spinning, size_t first, size_t n) {
+        float* __restrict out = strength[1 - current].data() + first;
+        #pragma omp simd
+        for(size_t i = 0; i < n; i++) {
+            float ct = THRUST_COEFFICIENT * maxValue(1.0f - pitch[i] / FEATHER_PITCH, 0.0f);
+            out[i] = spinning[i] * (1.0f - sqrtf(1.0f - ct));
+        }
+    }
+    
+    // After every turbine's thrust was updated
+    void swap() { current = 1 - current; }
+
+private:
+    // Share of the free wind a turbine of radius r, dx m downstream and dy m
+    // to the side, takes from the wake of one of radius upstreamRadius, per
+    // unit of thrust; 0 when it is not in the wake
+    static float couple(float dx, float dy, float r, float upstreamRadius) {
+        if(dx <= 0.0f || dx > 2.0f * upstreamRadius * MAX_DIAMETERS) return 0.0f;
+        float wake = upstreamRadius + DECAY * dx;
+        float overlap = min(dy + r, wake) - max(dy - r, -wake);
+        if(overlap <= 0.0f) return 0.0f;
+        float shrink = upstreamRadius / wake;
+        return shrink * shrink * min(overlap / (2.0f * r), 1.0f);
+    }
+};
+
+
+// Components an entity can have; an archetype's signature is a mask of these
+enum Component {
+    COMPONENT_IDENTITY,       // Handle slot; every entity has it
+    COMPONENT_TRANSFORM,      // Position
+    COMPONENT_ROTOR,          // Blade angle and speed
+    COMPONENT_CLOUD_MOTION,   // Drift along x
+    COMPONENT_RENDERABLE,     // Visibility and damage tracking
+    COMPONENT_SELECTABLE,     // Keyboard selection
+    COMPONENT_TURBINE_SHAPE,  // Windmill dimensions and shared meshes
+    COMPONENT_CELESTIAL,      // Sun or moon
+    COMPONENT_COMPACT_ROTOR,  // Quantized position, blade phase and speed
+    COMPONENT_COUNT
+};
+
+typedef uint32_t ComponentMask;
+
+constexpr ComponentMask componentBit(Component c) { return 1u << c; }
+
+// Every component is a group of columns, stored one array per column
+enum Column {
+    COLUMN_ENTITY,
+    COLUMN_X, COLUMN_Y,
+    COLUMN_ROTOR_ANGLE, COLUMN_ROTOR_PREVIOUS, COLUMN_ROTOR_SHOWN, COLUMN_ROTOR_SPEED,
+    COLUMN_ROTOR_SPINNING, COLUMN_ROTOR_OMEGA, COLUMN_ROTOR_PITCH, COLUMN_ROTOR_WIND,
+    COLUMN_ROTOR_RADIUS, COLUMN_ROTOR_INERTIA, COLUMN_ROTOR_GAIN, COLUMN_ROTOR_RATED,
+    COLUMN_ROTOR_POWER, COLUMN_ROTOR_ENERGY,
+    COLUMN_CLOUD_PREVIOUS_X, COLUMN_CLOUD_SHOWN_X, COLUMN_CLOUD_SPEED, COLUMN_CLOUD_DRIFT,
+    COLUMN_CLOUD_WRAPPED,
+    COLUMN_VISIBLE, COLUMN_DAMAGED, COLUMN_DRAWN_BOUNDS, COLUMN_SCALE,
+    COLUMN_SELECTED,
+    COLUMN_SHAPE, COLUMN_GEOMETRY,
+    COLUMN_CELESTIAL_ANGLE, COLUMN_CELESTIAL_RADIUS, COLUMN_CELESTIAL_COLOR,
+    COLUMN_COMPACT_X, COLUMN_COMPACT_Y, COLUMN_COMPACT_PHASE, COLUMN_COMPACT_PREVIOUS,
+    COLUMN_COMPACT_SHOWN, COLUMN_COMPACT_SPEED, COLUMN_COMPACT_STATUS,
+    COLUMN_COUNT
+};
+
+struct ColumnInfo {
+    Component component;
+    size_t size;   // Bytes per entity
+};
+
+const ColumnInfo COLUMNS[COLUMN_COUNT] = {
+    {COMPONENT_IDENTITY, sizeof(uint32_t)},               // Slot in the archetype's handle table
+    {COMPONENT_TRANSFORM, sizeof(float)},                 // x
+    {COMPONENT_TRANSFORM, sizeof(float)},                 // y
+    {COMPONENT_ROTOR, sizeof(float)},                     // Degrees, [0, 360)
+    {COMPONENT_ROTOR, sizeof(float)},                     // Angle before the last step
+    {COMPONENT_ROTOR, sizeof(float)},                     // Interpolated angle that is drawn
+    {COMPONENT_ROTOR, sizeof(float)},                     // Degrees per step, from the dynamics
+    {COMPONENT_ROTOR, sizeof(float)},                     // 1 rotating, 0 braked; multiplies speed
+    {COMPONENT_ROTOR, sizeof(float)},                     // Rotor speed, rad/s
+    {COMPONENT_ROTOR, sizeof(float)},                     // Blade pitch, degrees
+    {COMPONENT_ROTOR, sizeof(float)},                     // Wind at the turbine, after wakes, m/s
+    {COMPONENT_ROTOR, sizeof(float)},                     // Blade length, m
+    {COMPONENT_ROTOR, sizeof(float)},                     // kg m²
+    {COMPONENT_ROTOR, sizeof(float)},                     // Generator torque per ω²
+    {COMPONENT_ROTOR, sizeof(float)},                     // Rated rotor speed, rad/s
+    {COMPONENT_ROTOR, sizeof(float)},                     // Electrical power, W
+    {COMPONENT_ROTOR, sizeof(double)},                    // Energy generated, J
+    {COMPONENT_CLOUD_MOTION, sizeof(float)},              // x before the last step
+    {COMPONENT_CLOUD_MOTION, sizeof(float)},              // Interpolated x that is drawn
+    {COMPONENT_CLOUD_MOTION, sizeof(float)},              // World units per step, from the wind
+    {COMPONENT_CLOUD_MOTION, sizeof(float)},              // Speed per m/s of wind
+    {COMPONENT_CLOUD_MOTION, sizeof(unsigned char)},      // Wrapped in the last step
+    {COMPONENT_RENDERABLE, sizeof(unsigned char)},        // Visible
+    {COMPONENT_RENDERABLE, sizeof(unsigned char)},        // Appearance changed since damage was collected
+    {COMPONENT_RENDERABLE, sizeof(Rect)},                 // Area covered when damage was last collected
+    {COMPONENT_RENDERABLE, sizeof(float)},                // Size: 1 for windmills, radius of a cloud
+    {COMPONENT_SELECTABLE, sizeof(unsigned char)},        // Drawn with the selection ring
+    {COMPONENT_TURBINE_SHAPE, sizeof(WindmillShape)},
+    {COMPONENT_TURBINE_SHAPE, sizeof(const WindmillTemplate*)},  // Resolved on first draw
+    {COMPONENT_CELESTIAL, sizeof(float)},                 // Animation angle
+    {COMPONENT_CELESTIAL, sizeof(float)},                 // Radius
+    {COMPONENT_CELESTIAL, sizeof(Color)},
+    {COMPONENT_COMPACT_ROTOR, sizeof(int16_t)},           // x * POSITION_SCALE
+    {COMPONENT_COMPACT_ROTOR, sizeof(int16_t)},           // y * POSITION_SCALE
+    {COMPONENT_COMPACT_ROTOR, sizeof(uint16_t)},          // Blade phase, 65536 per turn
+    {COMPONENT_COMPACT_ROTOR, sizeof(uint16_t)},          // Phase before the last step
+    {COMPONENT_COMPACT_ROTOR, sizeof(uint16_t)},          // Interpolated phase that is drawn
+    {COMPONENT_COMPACT_ROTOR, sizeof(uint8_t)},           // Speed code, PHASE_PER_CODE per step
+    {COMPONENT_COMPACT_ROTOR, sizeof(uint8_t)},           // Status bits
+};
+
+
+/**
+ * @class Arena
+ * @brief Bump allocator for everything a scene owns
+ *
+ * Memory comes from large blocks and is never freed one piece at a time.
+ * reset() hands every block back for reuse at once, so clearing a scene
+ * costs the same for ten entities as for a million, and a scene that
+ * grows back to its old size does not touch the heap again.
+ */
+class Arena {
+public:
+    static const size_t BLOCK_BYTES = size_t(16) << 20;
+    static const size_t ALIGN = 64;
+
+private:
+    struct Block {
+        unsigned char* memory;
+        size_t size;
+    };
+    
+    vector<Block> blocks;   // Kept across resets
+    size_t current;         // Block being filled
+    size_t used;            // Bytes used in it
+
+public:
+    Arena() : current(0), used(0) {}
+    
+    ~Arena() {
+        for(Block& block : blocks) ::operator delete(block.memory, align_val_t(ALIGN));
+    }
+    
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    // align must be a power of two no larger than ALIGN
+    void* allocate(size_t bytes, size_t align = ALIGN) {
+        while(true) {
+            if(current < blocks.size()) {
+                size_t offset = (used + align - 1) & ~(align - 1);
+                if(offset + bytes <= blocks[current].size) {
+                    used = offset + bytes;
+                    return blocks[current].memory + offset;
+                }
+                // The rest of this block is wasted until the next reset
+                current++;
+                used = 0;
+                continue;
+            }
+            size_t size = max(BLOCK_BYTES, bytes);
+            blocks.push_back({static_cast<unsigned char*>(::operator new(size, align_val_t(ALIGN))), size});
+        }
+    }
+    
+    // Forgets every allocation; the blocks stay for reuse
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+};
+
+
+/**
+ * @class Pool
+ * @brief Fixed-size objects on an arena, with a free list for reuse
+ *
+ * Released objects are handed out again as they were left, so an object
+ * that owns arena memory of its own keeps it. reset() goes with a reset
+ * of the arena and simply forgets every object.
+ */
+template<typename T>
+class Pool {
+    static_assert(is_trivially_destructible<T>::value, "pooled objects are never destroyed");
+    
+private:
+    Arena& arena;
+    vector<T*> spare;
+
+public:
+    explicit Pool(Arena& memory) : arena(memory) {}
+    
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+    
+    // A released object if there is one, otherwise a new value-initialised one
+    T* acquire() {
+        if(spare.empty()) return new(arena.allocate(sizeof(T), alignof(T))) T();
+        T* object = spare.back();
+        spare.pop_back();
+        return object;
+    }
+    
+    void release(T* object) { spare.push_back(object); }
+    
+    void reset() { spare.clear(); }
+    
+    // fn(object) for every released object
+    template<typename Fn>
+    void forEachSpare(Fn fn) {
+        for(T* object : spare) fn(*object);
+    }
+};
+
+
+/**
+ * @struct Chunk
+ * @brief A fixed block of rows of one archetype, one dense array per column
+ */
+struct Chunk {
+    // A multiple of 64, so every column starts on a cache line
+    static const size_t CAPACITY = 4096;
+    
+    unsigned char* columns[COLUMN_COUNT];  // nullptr for columns the archetype lacks
+    unsigned char* memory;                 // All columns, in one block
+    size_t base;                           // Archetype row of the first row
+    size_t count;
+    
+    template<typename T>
+    T* get(Column column) { return reinterpret_cast<T*>(columns[column]); }
+};
+
+
+
+/**
+ * @struct EntityHandle
+ * @brief Names one entity for as long as it exists
+ *
+ * Rows move when other entities are removed, so anything that outlives a
+ * step (the selection, the HUD) holds a handle instead. The generation
+ * changes whenever the slot is freed, so a handle to a removed entity
+ * never finds the entity that took its slot.
+ */
+struct EntityHandle {
+    uint32_t index;        // Slot in the archetype's handle table
+    uint32_t generation;   // Odd while the entity lives; 0 names nothing
+    
+    EntityHandle() : index(0), generation(0) {}
+    EntityHandle(uint32_t i, uint32_t g) : index(i), generation(g) {}
+    
+    bool operator==(const EntityHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+};
+
+
+/**
+ * @class Archetype
+ * @brief All entities with exactly the same components
+ *
+ * Rows are dense: row r lives in chunk r / CAPACITY. Systems walk the
+ * rows of every archetype that has the components they need, so no
+ * per-entity type check or virtual call is involved.
+ *
+ * Removing a row moves the last row into its place. The handle table maps
+ * each entity's slot to its current row, and the identity column maps
+ * back, so both directions stay O(1).
+ */
+class Archetype {
+private:
+    static const uint32_t NO_SLOT = 0xFFFFFFFFu;
+    
+    // A live slot holds its entity's row; a free one the next free slot
+    struct Slot {
+        uint32_t row;
+        uint32_t generation;
+    };
+    
+    // Leads the snapshot handle section, before the slots themselves
+    struct SlotState {
+        uint32_t slotsUsed;
+        uint32_t firstFree;
+        uint32_t baseGeneration;
+        uint32_t lastGeneration;
+    };
+    
+    ComponentMask mask;
+    size_t chunkBytes;
+    Arena& arena;
+    Pool<Chunk> chunkPool;   // Released chunks keep their column memory
+    vector<Chunk*> chunks;
+    size_t count;
+    
+    vector<Slot> slots;
+    uint32_t slotsUsed;        // Slots handed out since the last clear; the rest are stale
+    uint32_t firstFree;        // Most recently freed slot, or NO_SLOT
+    uint32_t baseGeneration;   // Even, and at least every generation handed out so far
+    uint32_t lastGeneration;   // Highest generation handed out so far
+
+public:
+    Archetype(ComponentMask components, Arena& memory)
+        : mask(components), chunkBytes(columnOffset(components, COLUMN_COUNT)), arena(memory),
+          chunkPool(memory), count(0), slotsUsed(0), firstFree(NO_SLOT), baseGeneration(0),
+          lastGeneration(0) {}
+    
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
+    
+    ComponentMask getMask() const { return mask; }
+    bool has(Component c) const { return (mask & componentBit(c)) != 0; }
+    size_t size() const { return count; }
+    
+    // Appends a zeroed row for a new entity and returns its index
+    size_t add() {
+        if(count == chunks.size() * Chunk::CAPACITY) chunks.push_back(newChunk(count));
+        chunks.back()->count++;
+        at<uint32_t>(count, COLUMN_ENTITY) = newSlot(static_cast<uint32_t>(count));
+        return count++;
+    }
+    
+    // Removes the entity in row by moving the last row into it
+    void remove(size_t row) {
+        size_t last = count - 1;
+        releaseSlot(at<uint32_t>(row, COLUMN_ENTITY));
+        
+        Chunk& to = *chunks[row / Chunk::CAPACITY];
+        Chunk& from = *chunks.back();
+        size_t i = row % Chunk::CAPACITY;
+        size_t j = last % Chunk::CAPACITY;
+        for(int c = 0; c < COLUMN_COUNT; c++) {
+            if(!from.columns[c]) continue;
+            size_t bytes = COLUMNS[c].size;
+            if(row != last) memcpy(to.columns[c] + i * bytes, from.columns[c] + j * bytes, bytes);
+            memset(from.columns[c] + j * bytes, 0, bytes);  // add() expects zeroed rows
+        }
+        if(row != last) slots[at<uint32_t>(row, COLUMN_ENTITY)].row = static_cast<uint32_t>(row);
+        
+        count--;
+        if(--from.count == 0) {
+            chunkPool.release(&from);
+            chunks.pop_back();
+        }
+    }
+    
+    // Drops every row; the chunks are kept for the next rows
+    void clear() {
+        for(Chunk* chunk : chunks) chunkPool.release(chunk);
+        chunks.clear();
+        count = 0;
+        forgetSlots();
+    }
+    
+    // Drops every row and forgets the chunks, ahead of a reset of the arena
+    void reset() {
+        chunkPool.reset();
+        chunks.clear();
+        count = 0;
+        forgetSlots();
+    }
+    
+    // Rows and handle table as snapshot sections; chunks go out exactly as
+    // they are in memory
+    void save(SnapshotWriter& out) const {
+        out.beginSection(SECTION_ROWS, mask, count);
+        for(const Chunk* chunk : chunks) out.write(chunk->memory, chunkBytes);
+        out.endSection();
+        
+        out.beginSection(SECTION_HANDLES, mask, slotsUsed);
+        out.writeValue(SlotState{slotsUsed, firstFree, baseGeneration, lastGeneration});
+        out.write(slots.data(), slotsUsed * sizeof(Slot));
+        out.endSection();
+    }
+    
+    // Whether attach() can take the snapshot's rows of an archetype with
+    // these components: the sections are complete, each live slot names a
+    // row whose identity names it back, there is one live slot per row,
+    // and the free list only runs through free slots
+    static bool fits(const Snapshot& in, ComponentMask components) {
+        const SnapshotSection* rows = in.find(SECTION_ROWS, components);
+        const SnapshotSection* handles = in.find(SECTION_HANDLES, components);
+        if(!rows || !handles) return rows == handles;
+        if(!(components & componentBit(COMPONENT_IDENTITY)) || rows->count > NO_SLOT) return false;
+        
+        size_t bytes = columnOffset(components, COLUMN_COUNT);
+        size_t chunkCount = (rows->count + Chunk::CAPACITY - 1) / Chunk::CAPACITY;
+        if(rows->bytes != chunkCount * bytes) return false;
+        
+        SectionReader reader(in, *handles);
+        SlotState state;
+        if(handles->bytes != sizeof(SlotState) + handles->count * sizeof(Slot) ||
+           !reader.readValue(state) || state.slotsUsed != handles->count || (state.baseGeneration & 1)) {
+            return false;
+        }
+        vector<Slot> table(state.slotsUsed);
+        reader.read(table.data(), table.size() * sizeof(Slot));
+        
+        const unsigned char* memory = in.data(*rows);
+        size_t identity = columnOffset(components, COLUMN_ENTITY);
+        uint32_t live = 0;
+        for(uint32_t index = 0; index < state.slotsUsed; index++) {
+            const Slot& slot = table[index];
+            if(slot.generation > state.lastGeneration) return false;
+            if(!(slot.generation & 1)) continue;
+            uint32_t owner;
+            if(slot.row >= rows->count) return false;
+            memcpy(&owner, memory + slot.row / Chunk::CAPACITY * bytes + identity +
+                           slot.row % Chunk::CAPACITY * sizeof(uint32_t), sizeof owner);
+            if(owner != index) return false;
+            live++;
+        }
+        if(live != rows->count) return false;
+        
+        // At most one visit per free slot, or the list has a cycle
+        uint32_t index = state.firstFree;
+        for(uint32_t visits = 0; index != NO_SLOT; visits++) {
+            if(index >= state.slotsUsed || (table[index].generation & 1) ||
+               visits == state.slotsUsed - live) {
+                return false;
+            }
+            index = table[index].row;
+        }
+        return true;
+    }
+    
+    // Takes the rows from a snapshot without copying them: each chunk points
+    // at its part of the mapped file, which must outlive the rows. The
+    // archetype must be empty. False, with nothing taken, unless fits()
+    // accepts the snapshot.
+    bool attach(const Snapshot& in) {
+        if(!fits(in, mask)) return false;
+        const SnapshotSection* rows = in.find(SECTION_ROWS, mask);
+        const SnapshotSection* handles = in.find(SECTION_HANDLES, mask);
+        if(!rows) return true;
+        
+        SectionReader reader(in, *handles);
+        SlotState state;
+        reader.readValue(state);
+        if(slots.size() < state.slotsUsed) slots.resize(state.slotsUsed);
+        reader.read(slots.data(), state.slotsUsed * sizeof(Slot));
+        slotsUsed = state.slotsUsed;
+        firstFree = state.firstFree;
+        baseGeneration = state.baseGeneration;
+        lastGeneration = max(lastGeneration, state.lastGeneration);
+        
+        unsigned char* memory = in.data(*rows);
+        size_t chunkCount = (rows->count + Chunk::CAPACITY - 1) / Chunk::CAPACITY;
+        for(size_t k = 0; k < chunkCount; k++) {
+            Chunk* chunk = chunkPool.acquire();
+            chunk->memory = memory + k * chunkBytes;
+            layOut(chunk, k * Chunk::CAPACITY);
+            chunk->count = min<size_t>(Chunk::CAPACITY, rows->count - chunk->base);
+            chunks.push_back(chunk);
+        }
+        count = rows->count;
+        return true;
+    }
+    
+    // Copies the rows that are still in the snapshot into the arena, so the
+    // snapshot can be released; released chunks in it give up their memory
+    void ownRows(const Snapshot& in) {
+        for(Chunk* chunk : chunks) {
+            if(!in.holds(chunk->memory)) continue;
+            unsigned char* memory = static_cast<unsigned char*>(arena.allocate(chunkBytes));
+            memcpy(memory, chunk->memory, chunkBytes);
+            size_t rows = chunk->count;
+            chunk->memory = memory;
+            layOut(chunk, chunk->base);
+            chunk->count = rows;
+        }
+        chunkPool.forEachSpare([&in](Chunk& chunk) {
+            if(in.holds(chunk.memory)) chunk.memory = nullptr;
+        });
+    }
+    
+    EntityHandle handle(size_t row) {
+        uint32_t slot = at<uint32_t>(row, COLUMN_ENTITY);
+        return EntityHandle(slot, slots[slot].generation);
+    }
+    
+    // The live entity in slot index, or a null handle
+    EntityHandle handleAt(uint32_t index) const {
+        if(index >= slotsUsed || !(slots[index].generation & 1)) return EntityHandle();
+        return EntityHandle(index, slots[index].generation);
+    }
+    
+    bool contains(EntityHandle entity) const {
+        return (entity.generation & 1) && entity.index < slotsUsed &&
+               slots[entity.index].generation == entity.generation;
+    }
+    
+    // Only for handles that contains() accepts
+    size_t rowOf(EntityHandle entity) const { return slots[entity.index].row; }
+    
+    template<typename T>
+    T& at(size_t row, Column column) {
+        return chunks[row / Chunk::CAPACITY]->get<T>(column)[row % Chunk::CAPACITY];
+    }
+    
+    // fn(chunk, begin, end) for each chunk's part of the rows [begin, end)
+    template<typename Fn>
+    void forRange(size_t begin, size_t end, Fn fn) {
+        while(begin < end) {
+            Chunk& chunk = *chunks[begin / Chunk::CAPACITY];
+            size_t first = begin % Chunk::CAPACITY;
+            size_t last = min(chunk.count, first + (end - begin));
+            fn(chunk, first, last);
+            begin += last - first;
+        }
+    }
+    
+    template<typename Fn>
+    void forEach(Fn fn) { forRange(0, count, fn); }
+    
+    // As forEach(), split across the job system; fn must only touch its own rows
+    template<typename Fn>
+    void parallelForEach(Fn fn) {
+        jobs.parallelFor(count, [this, &fn](size_t begin, size_t end) { forRange(begin, end, fn); });
+    }
+
+private:
+    Chunk* newChunk(size_t base) {
+        Chunk* chunk = chunkPool.acquire();
+        if(!chunk->memory) chunk->memory = static_cast<unsigned char*>(arena.allocate(chunkBytes));
+        memset(chunk->memory, 0, chunkBytes);
+        layOut(chunk, base);
+        return chunk;
+    }
+    
+    // Points the columns into the chunk's memory
+    void layOut(Chunk* chunk, size_t base) {
+        chunk->base = base;
+        chunk->count = 0;
+        
+        size_t offset = 0;
+        for(int c = 0; c < COLUMN_COUNT; c++) {
+            chunk->columns[c] = nullptr;
+            if(!(mask & componentBit(COLUMNS[c].component))) continue;
+            chunk->columns[c] = chunk->memory + offset;
+            offset += columnBytes(c);
+        }
+    }
+    
+    // Reuses the most recently freed slot, so the table stays as small as the
+    // largest the archetype has been
+    uint32_t newSlot(uint32_t row) {
+        uint32_t index = firstFree;
+        if(index != NO_SLOT) {
+            firstFree = slots[index].row;
+        } else {
+            index = slotsUsed++;
+            if(index == slots.size()) slots.push_back(Slot());
+            slots[index].generation = baseGeneration;
+        }
+        slots[index].row = row;
+        lastGeneration = max(lastGeneration, ++slots[index].generation);
+        return index;
+    }
+    
+    void releaseSlot(uint32_t index) {
+        lastGeneration = max(lastGeneration, ++slots[index].generation);
+        slots[index].row = firstFree;
+        firstFree = index;
+    }
+    
+    // O(1): later slots start above every generation handed out so far, so
+    // no handle from before survives
+    void forgetSlots() {
+        slotsUsed = 0;
+        firstFree = NO_SLOT;
+        baseGeneration = lastGeneration + (lastGeneration & 1);
+    }
+    
+    // Bytes before column in a chunk with these components; the whole
+    // chunk for COLUMN_COUNT
+    static size_t columnOffset(ComponentMask components, int column) {
+        size_t offset = 0;
+        for(int c = 0; c < column; c++) {
+            if(components & componentBit(COLUMNS[c].component)) offset += columnBytes(c);
+        }
+        return offset;
+    }
+    
+    // One spare cache line per column, so the same row of different columns
+    // does not fall on the same 4 KB offset and alias in the cache
+    static size_t columnBytes(int column) { return COLUMNS[column].size * Chunk::CAPACITY + 64; }
+};
+
+
+/**
+ * @class World
+ * @brief Owns one archetype per component combination in use
+ */
+class World {
+private:
+    Arena arena;   // Chunks of every archetype; declared first so it outlives them
+    unique_ptr<Snapshot> snapshot;   // Mapped rows of the loaded snapshot, if any
+    vector<unique_ptr<Archetype>> archetypes;
+
+public:
+    // Finds or creates the archetype for exactly these components, plus
+    // the identity every entity has
+    Archetype& archetype(ComponentMask mask) {
+        mask |= componentBit(COMPONENT_IDENTITY);
+        for(auto& a : archetypes) {
+            if(a->getMask() == mask) return *a;
+        }
+        archetypes.push_back(unique_ptr<Archetype>(new Archetype(mask, arena)));
+        return *archetypes.back();
+    }
+    
+    // fn(archetype) for every archetype that has all the required components
+    template<typename Fn>
+    void query(ComponentMask required, Fn fn) {
+        for(auto& a : archetypes) {
+            if((a->getMask() & required) == required) fn(*a);
+        }
+    }
+    
+    // Drops every entity in constant time per archetype; the (empty)
+    // archetypes and the arena's blocks stay for reuse
+    void clear() {
+        for(auto& a : archetypes) a->reset();
+        arena.reset();
+        snapshot.reset();
+    }
+    
+    // FNV-1a over every column's component and size, and the chunk
+    // capacity: snapshots only load into a build with the same rows
+    static uint64_t layout() {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        auto add = [&hash](uint64_t value) {
+            for(int b = 0; b < 8; b++) {
+                hash ^= (value >> (8 * b)) & 0xff;
+                hash *= 0x100000001b3ull;
+            }
+        };
+        add(Chunk::CAPACITY);
+        for(const ColumnInfo& column : COLUMNS) {
+            add(column.component);
+            add(column.size);
+        }
+        return hash;
+    }
+    
+    void save(SnapshotWriter& out) const {
+        for(const auto& a : archetypes) a->save(out);
+    }
+    
+    // Whether rows are still used in place from the file at path
+    bool maps(const string& path) const { return snapshot && snapshot->maps(path); }
+    
+    // Moves every row out of the snapshot and releases it
+    void ownRows() {
+        if(!snapshot) return;
+        for(auto& a : archetypes) a->ownRows(*snapshot);
+        snapshot.reset();
+    }
+    
+    // Whether attach() can take every archetype's rows: each has
+    // consistent sections, and only one
+    static bool fits(const Snapshot& in) {
+        for(uint32_t i = 0; i < in.getSectionCount(); i++) {
+            const SnapshotSection& s = in.section(i);
+            if(s.type != SECTION_ROWS) continue;
+            if(in.find(SECTION_ROWS, s.mask) != &s || !Archetype::fits(in, s.mask)) return false;
+        }
+        return true;
+    }
+    
+    // Replaces every entity with the snapshot's rows, used in place; the
+    // world keeps the mapping until the next clear. False, with the world
+    // as it was, unless fits() accepts the snapshot.
+    bool attach(unique_ptr<Snapshot> in) {
+        if(!fits(*in)) return false;
+        clear();
+        for(uint32_t i = 0; i < in->getSectionCount(); i++) {
+            const SnapshotSection& s = in->section(i);
+            if(s.type == SECTION_ROWS) archetype(s.mask).attach(*in);
+        }
+        snapshot = move(in);
+        return true;
+    }
+};
+
+
+/**
+ * @struct WindmillKind
+ * @brief Components, bounds and drawing of a windmill entity
+ *
+ * Each entity kind gathers its archetype-specific code as static functions,
+ * so systems instantiate their row loop once per kind with no dispatch
+ * inside it. A new kind needs a struct like this and a line in
+ * Scene::forEachKind().
+ */
+struct WindmillKind {
+    static const ComponentMask COMPONENTS =
+        componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_ROTOR) |
+        componentBit(COMPONENT_RENDERABLE) | componentBit(COMPONENT_SELECTABLE) |
+        componentBit(COMPONENT_TURBINE_SHAPE);
+    
+    // Tower plus the whole blade sweep, or the selection ring when larger
+    static Rect bounds(Chunk& chunk, size_t i) {
+        const WindmillShape& shape = chunk.get<WindmillShape>(COLUMN_SHAPE)[i];
+        float x = chunk.get<float>(COLUMN_X)[i];
+        float y = chunk.get<float>(COLUMN_Y)[i];
+        float reach = shape.bladeLength + 1.0f;
+        if(chunk.get<unsigned char>(COLUMN_SELECTED)[i]) reach = max(reach, SELECTION_RADIUS);
+        float hubY = y + shape.towerHeight;
+        Rect box(x - reach, hubY - reach, x + reach, hubY + reach);
+        box.include(Rect(x - shape.towerWidth / 2, y, x + shape.towerWidth / 2, hubY));
+        return box;
+    }
+    
+    // Hand the windmill to the fleet renderer
+    static void submit(Chunk& chunk, size_t i, RenderQueue& queue) {
+        const WindmillTemplate*& geometry = chunk.get<const WindmillTemplate*>(COLUMN_GEOMETRY)[i];
+        if(!geometry) geometry = GeometryCache::windmillTemplate(chunk.get<WindmillShape>(COLUMN_SHAPE)[i]);
+        queue.getFleet().add(geometry, {chunk.get<float>(COLUMN_X)[i], chunk.get<float>(COLUMN_Y)[i],
+                                        1.0f, chunk.get<float>(COLUMN_ROTOR_SHOWN)[i],
+                                        chunk.get<unsigned char>(COLUMN_SELECTED)[i] ? 1.0f : 0.0f});
+    }
+};
+
+/**
+ * @struct CompactWindmillKind
+ * @brief A windmill in quantized form, for fleets of millions
+ *
+ * Only the phase, speed and status bytes are touched every step, and the
+ * positions once per refresh; everything is drawn with the default shape.
+ * Compact windmills cannot be selected and neither cast nor feel wakes.
+ */
+struct CompactWindmillKind {
+    static const ComponentMask COMPONENTS =
+        componentBit(COMPONENT_COMPACT_ROTOR) | componentBit(COMPONENT_RENDERABLE);
+    
+    static constexpr WindmillShape SHAPE = {30.0f, 120.0f, CompactRotor::BLADE_LENGTH, 4};
+    
+    static Rect bounds(Chunk& chunk, size_t i) {
+        float x = CompactRotor::position(chunk.get<int16_t>(COLUMN_COMPACT_X)[i]);
+        float y = CompactRotor::position(chunk.get<int16_t>(COLUMN_COMPACT_Y)[i]);
+        float reach = SHAPE.bladeLength + 1.0f;
+        float hubY = y + SHAPE.towerHeight;
+        Rect box(x - reach, hubY - reach, x + reach, hubY + reach);
+        box.include(Rect(x - SHAPE.towerWidth / 2, y, x + SHAPE.towerWidth / 2, hubY));
+        return box;
+    }
+    
+    static void submit(Chunk& chunk, size_t i, RenderQueue& queue) {
+        static const WindmillTemplate* geometry = GeometryCache::windmillTemplate(SHAPE);
+        queue.getFleet().add(geometry, {CompactRotor::position(chunk.get<int16_t>(COLUMN_COMPACT_X)[i]),
+                                        CompactRotor::position(chunk.get<int16_t>(COLUMN_COMPACT_Y)[i]),
+                                        1.0f, CompactRotor::degrees(chunk.get<uint16_t>(COLUMN_COMPACT_SHOWN)[i]),
+                                        0.0f});
+    }
+};
+
+/**
+ * @struct CloudKind
+ * @brief Components, bounds and drawing of a cloud entity
+ */
+struct CloudKind {
+    static const ComponentMask COMPONENTS =
+        componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_CLOUD_MOTION) |
+        componentBit(COMPONENT_RENDERABLE);
+    
+    static Rect bounds(Chunk& chunk, size_t i) {
+        float shownX = chunk.get<float>(COLUMN_CLOUD_SHOWN_X)[i];
+        float y = chunk.get<float>(COLUMN_Y)[i];
+        float size = chunk.get<float>(COLUMN_SCALE)[i];
+        Rect box;
+        for(int p = 0; p < CloudBatcher::PUFF_COUNT; p++) {
+            float px = shownX + size * CloudBatcher::PUFFS[p][0];
+            float py = y + size * CloudBatcher::PUFFS[p][1];
+            float r = size * CloudBatcher::PUFFS[p][2];
+            box.include(Rect(px - r, py - r, px + r, py + r));
+        }
+        return box;
+    }
+
+    // Queue the cloud for the single batched draw
+    static void submit(Chunk& chunk, size_t i, RenderQueue& queue) {
+        queue.getClouds().add(chunk.get<float>(COLUMN_CLOUD_SHOWN_X)[i], chunk.get<float>(COLUMN_Y)[i],
+                              chunk.get<float>(COLUMN_SCALE)[i]);
+    }
+};
+
+/**
+ * @struct CelestialKind
+ * @brief Components, bounds and drawing of the sun or moon
+ */
+struct CelestialKind {
+    static const ComponentMask COMPONENTS =
+        componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_CELESTIAL) |
+        componentBit(COMPONENT_RENDERABLE);
+    
+    // Rays included; the angle is not drawn, so updates cause no damage
+    static Rect bounds(Chunk& chunk, size_t i) {
+        float x = chunk.get<float>(COLUMN_X)[i];
+        float y = chunk.get<float>(COLUMN_Y)[i];
+        float reach = chunk.get<float>(COLUMN_CELESTIAL_RADIUS)[i] + 15.0f;
+        return Rect(x - reach, y - reach, x + reach, y + reach);
+    }
+    
+    static void submit(Chunk& chunk, size_t i, RenderQueue& queue) {
+        float x = chunk.get<float>(COLUMN_X)[i];
+        float y = chunk.get<float>(COLUMN_Y)[i];
+        float radius = chunk.get<float>(COLUMN_CELESTIAL_RADIUS)[i];
+        Color color = chunk.get<Color>(COLUMN_CELESTIAL_COLOR)[i];
+        
+        if(isDay) {
+            const float* unit = CircleLibrary::unitCircle(12);
+            queue.startCommand(LAYER_CELESTIAL, GL_LINES);
+            for(int k = 0; k < 12; k++) {
+                queue.addVertex(x + (radius + 5) * unit[2 * k], y + (radius + 5) * unit[2 * k + 1], color);
+                queue.addVertex(x + (radius + 15) * unit[2 * k], y + (radius + 15) * unit[2 * k + 1], color);
+            }
+        }
+        
+        queue.startCommand(LAYER_CELESTIAL, GL_TRIANGLES);
+        CircleLibrary::appendDisc(queue, x, y, radius, color);
+    }
+};
+
+
+/**
+ * @class Windmill
+ * @brief Handle to one windmill, for the keyboard, HUD and reports
+ *
+ * Valid while the windmill exists, whatever else is added or removed;
+ * the simulation itself never goes through handles.
+ */
+class Windmill {
+private:
+    Archetype* archetype;
+    EntityHandle entity;
+    
+    size_t row() const { return archetype->rowOf(entity); }
+
+public:
+    Windmill(Archetype& a, EntityHandle e) : archetype(&a), entity(e) {}
+    
+    // Limits for the rated speed set with the + and - keys
+    static constexpr float MIN_RATED_RPM = 5.0f;
+    static constexpr float MAX_RATED_RPM = 40.0f;
+    static constexpr float RPM_PER_RAD_S = 60.0f / (2.0f * 3.14159265f);
+    
+    // Control methods
+    void toggleRotation() {
+        float& spinning = archetype->at<float>(row(), COLUMN_ROTOR_SPINNING);
+        spinning = spinning != 0.0f ? 0.0f : 1.0f;
+    }
+    // The rotor only reaches its rated speed if the wind allows it
+    void increaseSpeed() { setRatedSpeed(getRatedSpeed() + 1.0f); }
+    void decreaseSpeed() { setRatedSpeed(getRatedSpeed() - 1.0f); }
+    
+    void setRatedSpeed(float rpm) {
+        rpm = min(max(rpm, MIN_RATED_RPM), MAX_RATED_RPM);
+        archetype->at<float>(row(), COLUMN_ROTOR_RATED) = rpm / RPM_PER_RAD_S;
+    }
+    
+    // Getters
+    bool getIsRotating() const { return archetype->at<float>(row(), COLUMN_ROTOR_SPINNING) != 0.0f; }
+    float getSpeed() const { return archetype->at<float>(row(), COLUMN_ROTOR_OMEGA) * RPM_PER_RAD_S; }
+    float getRatedSpeed() const { return archetype->at<float>(row(), COLUMN_ROTOR_RATED) * RPM_PER_RAD_S; }
+    float getPitch() const { return archetype->at<float>(row(), COLUMN_ROTOR_PITCH); }
+    float getWind() const { return archetype->at<float>(row(), COLUMN_ROTOR_WIND); }
+    float getPower() const { return archetype->at<float>(row(), COLUMN_ROTOR_POWER); }
+    double getEnergy() const { return archetype->at<double>(row(), COLUMN_ROTOR_ENERGY); }
+    float getBladeAngle() const { return archetype->at<float>(row(), COLUMN_ROTOR_ANGLE); }
+    EntityHandle getHandle() const { return entity; }
+    // Shown in the HUD and typed on the keyboard; kept until the windmill is removed
+    int getId() const { return static_cast<int>(entity.index) + 1; }
+};
+
+/**
+ * @class Cloud
+ * @brief Handle to one cloud row
+ */
+class Cloud {
+private:
+    Archetype* archetype;
+    EntityHandle entity;
+    
+    size_t row() const { return archetype->rowOf(entity); }
+
+public:
+    Cloud(Archetype& a, EntityHandle e) : archetype(&a), entity(e) {}
+    
+    EntityHandle getHandle() const { return entity; }    
+    float getX() const { return archetype->at<float>(row(), COLUMN_X); }
+    float getY() const { return archetype->at<float>(row(), COLUMN_Y); }
+    float getSpeed() const { return archetype->at<float>(row(), COLUMN_CLOUD_SPEED); }
+    // Speed in world units per step when the wind blows at REFERENCE_SPEED
+    void setSpeed(float s) { archetype->at<float>(row(), COLUMN_CLOUD_DRIFT) = s / WindField::REFERENCE_SPEED; }
+};
+
+
+/**
+ * @class Scene
+ * @brief Manages all entities in the simulation and runs the systems over them
+ */
+class Scene {
+private:
+    World world;
+    Archetype& windmills;
+    Archetype& clouds;
+    Archetype& celestials;
+    Archetype& compacts;      // Compact windmills
+    EntityHandle selected;    // Null, or a windmill that may since have been removed
+    RenderQueue renderQueue;  // Sorted, batched drawing of all entities
+    Random random;            // From randomSeed; declared before what it seeds
+    RandomStream spawns;      // Positions and speeds of random new objects
+    uint64_t steps;           // Since the scene was created or cleared; counter and epoch of the cloud streams
+    WindField wind;           // Drives the rotors and moves the clouds
+    WakeModel wake;           // Wind deficits between the windmills
+    bool wakeDirty;           // Windmills were added or removed since the wakes were found
+    vector<double> powerBlocks;  // Windmill power summed per POWER_BLOCK rows
+    vector<double> compactPowerBlocks;  // The same for compact windmills
+    vector<Rect> vacated;     // Areas drawn by entities removed since damage was collected
+    double farmPower;         // W, in the last step
+    double farmEnergy;        // J, since the scene was created or cleared
+    
+    // The snapshot section of everything that is not in a column
+    struct SceneRecord {
+        uint32_t seed;
+        uint32_t spawnCounter;
+        uint64_t steps;
+        double farmPower;
+        double farmEnergy;
+        EntityHandle selected;
+        float windSpeed;
+        uint32_t reserved;
+    };
+
+public:
+    Scene()
+        : windmills(world.archetype(WindmillKind::COMPONENTS)),
+          clouds(world.archetype(CloudKind::COMPONENTS)),
+          celestials(world.archetype(CelestialKind::COMPONENTS)),
+          compacts(world.archetype(CompactWindmillKind::COMPONENTS)),
+          random(randomSeed), spawns(random, Random::SPAWN_STREAM), steps(0),
+          wind(random.key(Random::WIND_STREAM)),
+          wakeDirty(false), farmPower(0.0), farmEnergy(0.0) {}
+    
+    // Rows per partial sum of the farm power. Job ranges always start on a
+    // multiple of this, so no block is ever split between threads.
+    static const size_t POWER_BLOCK = JobSystem::GRAIN_ALIGN;
+    
+    // Heights between which random clouds appear
+    static constexpr float CLOUD_MIN_Y = 150.0f;
+    static constexpr float CLOUD_MAX_Y = 280.0f;
+    static const size_t SPAWN_BATCH = 256;
+    
+    EntityHandle addWindmill(float x, float y, float towerWidth = 30.0f, float towerHeight = 120.0f,
+                             float bladeLength = 80.0f, int blades = 4) {
+        size_t row = windmills.add();
+        windmills.at<float>(row, COLUMN_X) = x;
+        windmills.at<float>(row, COLUMN_Y) = y;
+        windmills.at<float>(row, COLUMN_ROTOR_SPINNING) = 1.0f;
+        
+        // Start in equilibrium with the local wind, below or at rated speed
+        const RotorModel& model = RotorModel::instance();
+        float radius = bladeLength * RotorModel::METERS_PER_UNIT;
+        float rated = RotorModel::RATED_TIP_SPEED / radius;
+        float local = wind.sample(x, y);
+        float omega = min(model.getOptimalLambda() * local / radius, rated);
+        windmills.at<float>(row, COLUMN_ROTOR_RADIUS) = radius;
+        windmills.at<float>(row, COLUMN_ROTOR_INERTIA) = RotorModel::inertia(radius);
+        windmills.at<float>(row, COLUMN_ROTOR_GAIN) = model.optimalGain(radius);
+        windmills.at<float>(row, COLUMN_ROTOR_RATED) = rated;
+        windmills.at<float>(row, COLUMN_ROTOR_WIND) = local;
+        windmills.at<float>(row, COLUMN_ROTOR_OMEGA) = omega;
+        windmills.at<float>(row, COLUMN_ROTOR_SPEED) = omega * static_cast<float>(SIMULATION_STEP * 180.0 / 3.14159265);
+        windmills.at<WindmillShape>(row, COLUMN_SHAPE) = {towerWidth, towerHeight, bladeLength, blades};
+        show(windmills, row);
+        wakeDirty = true;
+        
+        // Selected when nothing else is, as the first windmill always is
+        EntityHandle entity = windmills.handle(row);
+        if(!hasSelection()) select(entity);
+        return entity;
+    }
+    
+    EntityHandle addCloud(float x, float y, float speed = 0.3f, float size = 25.0f) {
+        size_t row = clouds.add();
+        clouds.at<float>(row, COLUMN_X) = x;
+        clouds.at<float>(row, COLUMN_Y) = y;
+        clouds.at<float>(row, COLUMN_CLOUD_PREVIOUS_X) = x;
+        clouds.at<float>(row, COLUMN_CLOUD_SHOWN_X) = x;
+        clouds.at<float>(row, COLUMN_CLOUD_DRIFT) = speed / WindField::REFERENCE_SPEED;
+        clouds.at<float>(row, COLUMN_CLOUD_SPEED) = speed / WindField::REFERENCE_SPEED * wind.sample(x, y);
+        clouds.at<float>(row, COLUMN_SCALE) = size;
+        show(clouds, row);
+        return clouds.handle(row);
+    }
+    
+    // A windmill with the default shape that keeps only quantized state
+    EntityHandle addCompactWindmill(float x, float y) {
+        size_t row = compacts.add();
+        int16_t qx = CompactRotor::quantize(x);
+        int16_t qy = CompactRotor::quantize(y);
+        float local = wind.sample(CompactRotor::position(qx), CompactRotor::position(qy));
+        compacts.at<int16_t>(row, COLUMN_COMPACT_X) = qx;
+        compacts.at<int16_t>(row, COLUMN_COMPACT_Y) = qy;
+        compacts.at<uint8_t>(row, COLUMN_COMPACT_SPEED) = CompactRotor::instance().speedCode(local);
+        compacts.at<uint8_t>(row, COLUMN_COMPACT_STATUS) = CompactRotor::SPINNING;
+        show(compacts, row);
+        return compacts.handle(row);
+    }
+    
+    // n windmills where the W key puts them, drawn in one batch; returns the last
+    EntityHandle addRandomWindmills(size_t n, bool compact = false) {
+        EntityHandle last;
+        float units[2 * SPAWN_BATCH];
+        for(size_t done = 0; done < n; done += SPAWN_BATCH) {
+            size_t count = min(SPAWN_BATCH, n - done);
+            spawns.fillUniform(units, 2 * count, 0.0f, 1.0f);
+            for(size_t i = 0; i < count; i++) {
+                float x = -400.0f + 800.0f * units[2 * i];
+                float y = -300.0f + 120.0f * units[2 * i + 1];
+                last = compact ? addCompactWindmill(x, y) : addWindmill(x, y);
+            }
+        }
+        return last;
+    }
+    
+    EntityHandle addRandomClouds(size_t n) {
+        EntityHandle last;
+        float units[3 * SPAWN_BATCH];
+        for(size_t done = 0; done < n; done += SPAWN_BATCH) {
+            size_t count = min(SPAWN_BATCH, n - done);
+            spawns.fillUniform(units, 3 * count, 0.0f, 1.0f);
+            for(size_t i = 0; i < count; i++) {
+                float y = CLOUD_MIN_Y + (CLOUD_MAX_Y - CLOUD_MIN_Y) * units[3 * i + 1];
+                last = addCloud(-450.0f + 900.0f * units[3 * i], y, 0.2f + 0.3f * units[3 * i + 2]);
+            }
+        }
+        return last;
+    }
+    
+    // O(1) apart from finding the wakes again before the next step.
+    // False if the windmill was already gone.
+    bool removeWindmill(EntityHandle entity) {
+        if(!remove(windmills, entity)) return false;
+        wakeDirty = true;
+        return true;
+    }
+    
+    bool removeCloud(EntityHandle entity) { return remove(clouds, entity); }
+    
+    void setCelestialBody(float x, float y, float radius, Color color) {
+        celestials.clear();
+        size_t row = celestials.add();
+        celestials.at<float>(row, COLUMN_X) = x;
+        celestials.at<float>(row, COLUMN_Y) = y;
+        celestials.at<float>(row, COLUMN_CELESTIAL_RADIUS) = radius;
+        celestials.at<Color>(row, COLUMN_CELESTIAL_COLOR) = color;
+        show(celestials, row);
+    }
+    
+    size_t getWindmillCount() const { return windmills.size(); }
+    size_t getCloudCount() const { return clouds.size(); }
+    size_t getCompactCount() const { return compacts.size(); }
+    uint32_t getSeed() const { return random.getSeed(); }
+    uint64_t getSteps() const { return steps; }   // Including those restored from a snapshot
+    
+    // Degrees, summed over every compact windmill, for reports
+    double getCompactAngleSum() {
+        double sum = 0.0;
+        compacts.forEach([&sum](Chunk& chunk, size_t begin, size_t end) {
+            const uint16_t* phase = chunk.get<uint16_t>(COLUMN_COMPACT_PHASE);
+            for(size_t i = begin; i < end; i++) sum += CompactRotor::degrees(phase[i]);
+        });
+        return sum;
+    }
+    // By row, which changes when windmills are removed; keep the handle instead
+    Windmill getWindmill(size_t index) { return Windmill(windmills, windmills.handle(index)); }
+    Cloud getCloud(size_t index) { return Cloud(clouds, clouds.handle(index)); }
+    
+    int getSelectedWindmill() const { return hasSelection() ? static_cast<int>(selected.index) + 1 : 0; }
+    bool hasSelection() const { return windmills.contains(selected); }
+    Windmill getSelected() { return Windmill(windmills, selected); }
+    
+    // By the number shown in the HUD; false if no windmill has it
+    bool selectWindmill(int number) {
+        EntityHandle entity = number > 0 ? windmills.handleAt(static_cast<uint32_t>(number - 1)) : EntityHandle();
+        select(entity);
+        return hasSelection();
+    }
+    
+    // Draws the entities that reach into area (world space)
+    void drawAll(RenderBackend& backend, const Rect& area) {
+        renderQueue.begin();
+        forEachKind([&](auto kind, Archetype& archetype) {
+            typedef decltype(kind) Kind;
+            archetype.forEach([&](Chunk& chunk, size_t begin, size_t end) {
+                const unsigned char* visible = chunk.get<unsigned char>(COLUMN_VISIBLE);
+                const Rect* drawn = chunk.get<Rect>(COLUMN_DRAWN_BOUNDS);
+                for(size_t i = begin; i < end; i++) {
+                    if(visible[i] && drawn[i].overlaps(area)) Kind::submit(chunk, i, renderQueue);
+                }
+            });
+        });
+        renderQueue.flush(backend);
+    }
+    
+    // Adds the old and new covered areas of everything that changed.
+    // Must run before drawAll() so the culling bounds are current.
+    void collectDamage(DamageRegion& region) {
+        bool refreshAll = region.isFull();  // Bounds may depend on selection or mode
+        for(const Rect& area : vacated) region.add(area);
+        vacated.clear();
+        forEachKind([&](auto kind, Archetype& archetype) {
+            typedef decltype(kind) Kind;
+            archetype.forEach([&](Chunk& chunk, size_t begin, size_t end) {
+                const unsigned char* visible = chunk.get<unsigned char>(COLUMN_VISIBLE);
+                unsigned char* damaged = chunk.get<unsigned char>(COLUMN_DAMAGED);
+                Rect* drawn = chunk.get<Rect>(COLUMN_DRAWN_BOUNDS);
+                for(size_t i = begin; i < end; i++) {
+                    if(!damaged[i] && !refreshAll) continue;
+                    region.add(drawn[i]);
+                    drawn[i] = visible[i] ? Kind::bounds(chunk, i) : Rect();
+                    region.add(drawn[i]);
+                    damaged[i] = 0;
+                }
+            });
+        });
+    }
+    
+    bool hasDamage() {
+        bool found = !vacated.empty();
+        world.query(componentBit(COMPONENT_RENDERABLE), [&](Archetype& archetype) {
+            archetype.forEach([&](Chunk& chunk, size_t begin, size_t end) {
+                const unsigned char* damaged = chunk.get<unsigned char>(COLUMN_DAMAGED);
+                for(size_t i = begin; i < end && !found; i++) found = damaged[i] != 0;
+            });
+        });
+        return found;
+    }
+    
+    const RenderStats& getRenderStats() const { return renderQueue.getStats(); }
+    
+    const WindField& getWind() const { return wind; }
+    size_t getWakeLinkCount() const { return wake.getLinkCount(); }
+    double getFarmPower() const { return farmPower; }
+    double getFarmEnergy() const { return farmEnergy; }
+    
+    // One fixed step of every system
+    void updateAll() {
+        if(!isPaused) {
+            steps++;
+            wind.advance();
+        }
+        stepRotors();
+        stepCompactRotors();
+        if(!isPaused) sumFarmPower();
+        stepClouds();
+        stepCelestials();
+    }
+    
+    // Blends the last two steps for display; alpha in [0, 1)
+    void interpolate(float alpha) {
+        interpolateRotors(alpha);
+        interpolateCompactRotors(alpha);
+        interpolateClouds(alpha);
+    }
+    
+    // Streams the scene to path: the chunks straight from memory, then the
+    // wind, the wakes and the scalars. False if the file cannot be written.
+    bool save(const string& path) {
+        // The file is replaced, not rewritten, but the rows must not keep the
+        // replaced file's pages alive or depend on the save succeeding
+        if(world.maps(path)) world.ownRows();
+        SnapshotWriter out;
+        if(!out.open(path, World::layout())) return false;
+        out.beginSection(SECTION_SCENE, 0, 1);
+        out.writeValue(SceneRecord{random.getSeed(), spawns.getCounter(), steps, farmPower,
+                                   farmEnergy, selected, windSpeed, 0});
+        out.endSection();
+        wind.save(out);
+        if(!wakeDirty) wake.save(out);
+        world.save(out);
+        return out.finish();
+    }
+    
+    // Replaces the scene with a snapshot from save(). The rows stay in the
+    // mapped file and are only read as they are used, so this takes about
+    // as long as mapping it. False, with the scene as it was, if the file
+    // is not a usable snapshot: every section is checked before any of it
+    // is taken.
+    bool load(const string& path) {
+        unique_ptr<Snapshot> in(new Snapshot());
+        if(!in->open(path, World::layout())) return false;
+        const SnapshotSection* section = in->find(SECTION_SCENE, 0);
+        SceneRecord record;
+        if(!section || !SectionReader(*in, *section).readValue(record)) {
+            cerr << "Snapshot " << path << " has no scene" << endl;
+            return false;
+        }
+        
+        if(!wind.fits(*in) || !World::fits(*in)) {
+            cerr << "Snapshot " << path << " does not match this scene" << endl;
+            return false;
+        }
+        
+        windSpeed = record.windSpeed;
+        random = Random(record.seed);
+        clear();
+        spawns = RandomStream(random, Random::SPAWN_STREAM, record.spawnCounter);
+        steps = record.steps;
+        farmPower = record.farmPower;
+        farmEnergy = record.farmEnergy;
+        wind.load(*in);
+        // Without usable wakes the farm's are found again on the next step
+        const SnapshotSection* rows = in->find(SECTION_ROWS, windmills.getMask());
+        wakeDirty = !wake.load(*in, rows ? rows->count : 0);
+        world.attach(move(in));
+        if(windmills.contains(record.selected)) selected = record.selected;
+        
+        // Geometry pointers are from the saving process; they are looked up again when drawn
+        windmills.forEach([](Chunk& chunk, size_t begin, size_t end) {
+            memset(chunk.get<const WindmillTemplate*>(COLUMN_GEOMETRY) + begin, 0,
+                   (end - begin) * sizeof(const WindmillTemplate*));
+        });
+        return true;
+    }
+    
+    void clear() {
+        world.clear();
+        selected = EntityHandle();
+        vacated.clear();
+        spawns = RandomStream(random, Random::SPAWN_STREAM);
+        steps = 0;
+        wind.reset();
+        wakeDirty = true;
+        farmPower = 0.0;
+        farmEnergy = 0.0;
+    }
+
+private:
+    // New rows start hidden and clean; show them and schedule their first draw
+    static void show(Archetype& archetype, size_t row) {
+        archetype.at<unsigned char>(row, COLUMN_VISIBLE) = 1;
+        archetype.at<unsigned char>(row, COLUMN_DAMAGED) = 1;
+    }
+    
+    // The row moved into the gap keeps its drawn bounds, so only the
+    // removed entity's area needs redrawing
+    bool remove(Archetype& archetype, EntityHandle entity) {
+        if(!archetype.contains(entity)) return false;
+        size_t row = archetype.rowOf(entity);
+        vacated.push_back(archetype.at<Rect>(row, COLUMN_DRAWN_BOUNDS));
+        archetype.remove(row);
+        return true;
+    }
+    
+    void select(EntityHandle entity) {
+        if(hasSelection()) windmills.at<unsigned char>(windmills.rowOf(selected), COLUMN_SELECTED) = 0;
+        selected = entity;
+        if(hasSelection()) windmills.at<unsigned char>(windmills.rowOf(selected), COLUMN_SELECTED) = 1;
+    }
+    
+    static RotorColumns rotorColumns(Chunk& chunk) {
+        return {chunk.get<float>(COLUMN_ROTOR_OMEGA), chunk.get<float>(COLUMN_ROTOR_PITCH),
+                chunk.get<float>(COLUMN_ROTOR_SPEED), chunk.get<float>(COLUMN_ROTOR_POWER),
+                chunk.get<double>(COLUMN_ROTOR_ENERGY), chunk.get<float>(COLUMN_ROTOR_WIND),
+                chunk.get<float>(COLUMN_ROTOR_RADIUS), chunk.get<float>(COLUMN_ROTOR_INERTIA),
+                chunk.get<float>(COLUMN_ROTOR_GAIN), chunk.get<float>(COLUMN_ROTOR_RATED),
+                chunk.get<float>(COLUMN_ROTOR_SPINNING)};
+    }
+    
+    // fn(Kind(), archetype) for each entity kind
+    template<typename Fn>
+    void forEachKind(Fn fn) {
+        fn(WindmillKind(), windmills);
+        fn(CloudKind(), clouds);
+        fn(CelestialKind(), celestials);
+        fn(CompactWindmillKind(), compacts);
+    }
+    
+    // Every turbine reads the thrust its upstream neighbours had in the
+    // previous step, so the rows can run in any order and on any thread
+    void stepRotors() {
+        if(wakeDirty) rebuildWakes();
+        powerBlocks.resize((windmills.size() + POWER_BLOCK - 1) / POWER_BLOCK);
+        WindGrid field = wind.grid();
+        world.query(componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_ROTOR),
+                    [this, &field](Archetype& archetype) {
+            bool farm = &archetype == &windmills;
+            WakeModel* wakes = farm ? &wake : nullptr;
+            double* blocks = farm ? powerBlocks.data() : nullptr;
+            archetype.parallelForEach([wakes, blocks, &field](Chunk& chunk, size_t begin, size_t end) {
+                float* angle = chunk.get<float>(COLUMN_ROTOR_ANGLE) + begin;
+                float* previous = chunk.get<float>(COLUMN_ROTOR_PREVIOUS) + begin;
+                if(isPaused) {
+                    copy(angle, angle + (end - begin), previous);
+                    return;
+                }
+                // All passes on the same few columns while they are in cache
+                RotorColumns rotor = rotorColumns(chunk).offset(begin);
+                simdKernels->sampleWind(field, chunk.get<float>(COLUMN_X) + begin,
+                                        chunk.get<float>(COLUMN_Y) + begin, nullptr,
+                                        chunk.get<float>(COLUMN_ROTOR_WIND) + begin, end - begin);
+                if(wakes) wakes->apply(chunk.get<float>(COLUMN_ROTOR_WIND) + begin, chunk.base + begin, end - begin);
+                simdKernels->integrateRotors(rotor, end - begin);
+                simdKernels->stepRotors(angle, previous, rotor.degreesPerStep, rotor.spinning, end - begin);
+                if(wakes) wakes->updateThrust(rotor.pitch, rotor.spinning, chunk.base + begin, end - begin);
+                if(blocks) sumPower(rotor.power, chunk.base + begin, end - begin, blocks);
+            });
+        });
+        if(!isPaused) wake.swap();
+    }
+    
+    // Only the phase bytes move every step. The speed of one slice of the
+    // compact windmills follows the wind each step, so each is refreshed
+    // once per wind keyframe.
+    void stepCompactRotors() {
+        compactPowerBlocks.resize((compacts.size() + POWER_BLOCK - 1) / POWER_BLOCK);
+        if(!isPaused) {
+            size_t count = compacts.size();
+            size_t phase = steps % WindField::KEYFRAME_STEPS;
+            refreshCompactSpeeds(count * phase / WindField::KEYFRAME_STEPS,
+                                 count * (phase + 1) / WindField::KEYFRAME_STEPS);
+        }
+        double* blocks = compactPowerBlocks.data();
+        compacts.parallelForEach([blocks](Chunk& chunk, size_t begin, size_t end) {
+            uint16_t* phase = chunk.get<uint16_t>(COLUMN_COMPACT_PHASE) + begin;
+            uint16_t* previous = chunk.get<uint16_t>(COLUMN_COMPACT_PREVIOUS) + begin;
+            if(isPaused) {
+                copy(phase, phase + (end - begin), previous);
+                return;
+            }
+            const uint8_t* speed = chunk.get<uint8_t>(COLUMN_COMPACT_SPEED) + begin;
+            const uint8_t* status = chunk.get<uint8_t>(COLUMN_COMPACT_STATUS) + begin;
+            simdKernels->stepPhases(phase, previous, speed, status, end - begin);
+            sumCompactPower(speed, status, chunk.base + begin, end - begin, blocks);
+        });
+    }
+    
+    // Steady speed codes of rows [first, last) from the wind at their positions
+    void refreshCompactSpeeds(size_t first, size_t last) {
+        WindGrid field = wind.grid();
+        const CompactRotor& rotor = CompactRotor::instance();
+        jobs.parallelFor(last - first, [&](size_t begin, size_t end) {
+            compacts.forRange(first + begin, first + end, [&](Chunk& chunk, size_t from, size_t to) {
+                const int16_t* qx = chunk.get<int16_t>(COLUMN_COMPACT_X);
+                const int16_t* qy = chunk.get<int16_t>(COLUMN_COMPACT_Y);
+                uint8_t* speed = chunk.get<uint8_t>(COLUMN_COMPACT_SPEED);
+                const size_t BLOCK = 256;
+                float x[BLOCK], y[BLOCK], local[BLOCK];
+                for(size_t b = from; b < to; b += BLOCK) {
+                    size_t n = min(BLOCK, to - b);
+                    for(size_t i = 0; i < n; i++) {
+                        x[i] = CompactRotor::position(qx[b + i]);
+                        y[i] = CompactRotor::position(qy[b + i]);
+                    }
+                    simdKernels->sampleWind(field, x, y, nullptr, local, n);
+                    for(size_t i = 0; i < n; i++) speed[b + i] = rotor.speedCode(local[i]);
+                }
+            });
+        });
+    }
+    
+    // As sumPower(), with each compact windmill's power from the speed table
+    static void sumCompactPower(const uint8_t* speed, const uint8_t* status, size_t first, size_t n,
+                                double* blocks) {
+        const double* table = CompactRotor::instance().getPowerTable();
+        for(size_t b = 0; b < n; b += POWER_BLOCK) {
+            double sum = 0.0;
+            for(size_t i = b; i < min(n, b + POWER_BLOCK); i++) {
+                if(status[i] & CompactRotor::SPINNING) sum += table[speed[i]];
+            }
+            blocks[(first + b) / POWER_BLOCK] = sum;
+        }
+    }
+    
+    // The blocks always add up in the same order, whatever the threads did
+    void sumFarmPower() {
+        farmPower = 0.0;
+        for(double block : powerBlocks) farmPower += block;
+        for(double block : compactPowerBlocks) farmPower += block;
+        farmEnergy += farmPower * SIMULATION_STEP;
+    }
+    
+    // Partial sums of rows [first, first + n), which starts on a block boundary,
+    // into blocks[row / POWER_BLOCK]
+    static void sumPower(const float* power, size_t first, size_t n, double* blocks) {
+        for(size_t b = 0; b < n; b += POWER_BLOCK) {
+            double sum = 0.0;
+            for(size_t i = b; i < min(n, b + POWER_BLOCK); i++) sum += power[i];
+            blocks[(first + b) / POWER_BLOCK] = sum;
+        }
+    }
+    
+    // Collects the windmill columns the wake search needs
+    void rebuildWakes() {
+        vector<float> x, y, radius, pitch, spinning;
+        windmills.forEach([&](Chunk& chunk, size_t begin, size_t end) {
+            auto append = [&](vector<float>& to, Column column) {
+                const float* from = chunk.get<float>(column);
+                to.insert(to.end(), from + begin, from + end);
+            };
+            append(x, COLUMN_X);
+            append(y, COLUMN_Y);
+            append(radius, COLUMN_ROTOR_RADIUS);
+            append(pitch, COLUMN_ROTOR_PITCH);
+            append(spinning, COLUMN_ROTOR_SPINNING);
+        });
+        wake.rebuild(x, y, radius, pitch, spinning);
+        wakeDirty = false;
+    }
+    
+    // A cloud that wraps gets a new height from its own stream, at the
+    // counter of this step, so no height depends on how the rows were split.
+    // The counter is the step's low word and the stream's epoch its high
+    // word, so heights never repeat however long the run.
+    void stepClouds() {
+        WindGrid field = wind.grid();
+        const Random& heights = random;
+        uint32_t counter = static_cast<uint32_t>(steps);
+        uint64_t streams = Random::CLOUD_STREAMS + (steps >> 32 << Random::EPOCH_SHIFT);
+        world.query(componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_CLOUD_MOTION),
+                    [&](Archetype& archetype) {
+            archetype.parallelForEach([&](Chunk& chunk, size_t begin, size_t end) {
+                float* x = chunk.get<float>(COLUMN_X) + begin;
+                float* previous = chunk.get<float>(COLUMN_CLOUD_PREVIOUS_X) + begin;
+                if(isPaused) {
+                    copy(x, x + (end - begin), previous);
+                    return;
+                }
+                float* speed = chunk.get<float>(COLUMN_CLOUD_SPEED) + begin;
+                simdKernels->sampleWind(field, x, chunk.get<float>(COLUMN_Y) + begin,
+                                        chunk.get<float>(COLUMN_CLOUD_DRIFT) + begin, speed, end - begin);
+                unsigned char* wrapped = chunk.get<unsigned char>(COLUMN_CLOUD_WRAPPED) + begin;
+                size_t wraps = simdKernels->stepClouds(x, previous, speed, wrapped, end - begin);
+                
+                const uint32_t* slot = chunk.get<uint32_t>(COLUMN_ENTITY) + begin;
+                float* y = chunk.get<float>(COLUMN_Y) + begin;
+                for(size_t i = 0; wraps > 0; i++) {
+                    if(!wrapped[i]) continue;
+                    y[i] = heights.uniform(streams + slot[i], counter, CLOUD_MIN_Y, CLOUD_MAX_Y);
+                    wraps--;
+                }
+            });
+        });
+    }
+    
+    void stepCelestials() {
+        if(isPaused || !animateCelestial) return;
+        world.query(componentBit(COMPONENT_CELESTIAL), [](Archetype& archetype) {
+            archetype.forEach([](Chunk& chunk, size_t begin, size_t end) {
+                float* angle = chunk.get<float>(COLUMN_CELESTIAL_ANGLE);
+                for(size_t i = begin; i < end; i++) {
+                    angle[i] += 0.3f;
+                    if(angle[i] >= 360.0f) angle[i] = 0.0f;
+                }
+            });
+        });
+    }
+    
+    // Blades only turn forwards, so a smaller angle means it wrapped past 360
+    void interpolateRotors(float alpha) {
+        world.query(componentBit(COMPONENT_ROTOR) | componentBit(COMPONENT_RENDERABLE),
+                    [alpha](Archetype& archetype) {
+            archetype.parallelForEach([alpha](Chunk& chunk, size_t begin, size_t end) {
+                const float* __restrict a = chunk.get<float>(COLUMN_ROTOR_ANGLE);
+                const float* __restrict prev = chunk.get<float>(COLUMN_ROTOR_PREVIOUS);
+                float* __restrict out = chunk.get<float>(COLUMN_ROTOR_SHOWN);
+                unsigned char* __restrict damaged = chunk.get<unsigned char>(COLUMN_DAMAGED);
+                #pragma omp simd
+                for(size_t i = begin; i < end; i++) {
+                    float delta = a[i] - prev[i];
+                    delta += 360.0f * (delta < 0.0f);
+                    float blended = prev[i] + delta * alpha;
+                    blended -= 360.0f * (blended >= 360.0f);
+                    damaged[i] |= blended != out[i];
+                    out[i] = blended;
+                }
+            });
+        });
+    }
+    
+    // Phase differences are taken modulo 65536, so wraps need no test
+    void interpolateCompactRotors(float alpha) {
+        compacts.parallelForEach([alpha](Chunk& chunk, size_t begin, size_t end) {
+            const uint16_t* __restrict phase = chunk.get<uint16_t>(COLUMN_COMPACT_PHASE);
+            const uint16_t* __restrict prev = chunk.get<uint16_t>(COLUMN_COMPACT_PREVIOUS);
+            uint16_t* __restrict out = chunk.get<uint16_t>(COLUMN_COMPACT_SHOWN);
+            unsigned char* __restrict damaged = chunk.get<unsigned char>(COLUMN_DAMAGED);
+            #pragma omp simd
+            for(size_t i = begin; i < end; i++) {
+                int delta = static_cast<uint16_t>(phase[i] - prev[i]);
+                uint16_t blended = static_cast<uint16_t>(prev[i] + static_cast<int>(delta * alpha));
+                damaged[i] |= blended != out[i];
+                out[i] = blended;
+            }
+        });
+    }
+    
+    void interpolateClouds(float alpha) {
+        world.query(componentBit(COMPONENT_TRANSFORM) | componentBit(COMPONENT_CLOUD_MOTION) |
+                    componentBit(COMPONENT_RENDERABLE), [alpha](Archetype& archetype) {
+            archetype.parallelForEach([alpha](Chunk& chunk, size_t begin, size_t end) {
+                const float* __restrict x = chunk.get<float>(COLUMN_X);
+                const float* __restrict prev = chunk.get<float>(COLUMN_CLOUD_PREVIOUS_X);
+                float* __restrict out = chunk.get<float>(COLUMN_CLOUD_SHOWN_X);
+                unsigned char* __restrict damaged = chunk.get<unsigned char>(COLUMN_DAMAGED);
+                #pragma omp simd
+                for(size_t i = begin; i < end; i++) {
+                    float blended = prev[i] + (x[i] - prev[i]) * alpha;
+                    damaged[i] |= blended != out[i];
+                    out[i] = blended;
+                }
+            });
+        });
+    }
+};
+
+
+Scene* scene = nullptr;
+
+
+/**
+ * @class SimulationClock
+ * @brief Fixed-timestep clock: real time goes in, whole simulation steps come out
+ *
+ * Scaled real time is added to an accumulator that is drained in steps of
+ * STEP seconds, so the simulation depends only on how many steps ran and
+ * never on timer jitter, frame rate or time scale. The remainder is the
+ * interpolation factor between the last two steps. The accumulator counts
+ * steps rather than seconds, so a frame of exactly STEP seconds at an
+ * integer scale always yields exactly that many steps.
+ */
+class SimulationClock {
+public:
+    static constexpr double STEP = SIMULATION_STEP;   // One tick of the original 16 ms timer
+    static constexpr double MAX_FRAME_TIME = 0.25;    // Longer stalls are not caught up
+    static const int MIN_SCALE = 1;
+    static const int MAX_SCALE = 10000;
+    
+private:
+    double pending;        // Steps owed, including the fractional remainder
+    long long steps;       // Steps run since start
+    int timeScale;
+    
+public:
+    SimulationClock() : pending(0.0), steps(0), timeScale(1) {}
+    
+    // Adds elapsed real time; returns the number of whole steps now due
+    long long advance(double realSeconds) {
+        realSeconds = min(max(realSeconds, 0.0), MAX_FRAME_TIME);
+        pending += realSeconds / STEP * timeScale;
+        long long due = static_cast<long long>(pending);
+        pending -= due;
+        return due;
+    }
+    
+    void stepDone() { steps++; }
+    
+    float getAlpha() const { return static_cast<float>(pending); }
+    long long getSteps() const { return steps; }
+    double getSimulatedSeconds() const { return steps * STEP; }
+    
+    int getTimeScale() const { return timeScale; }
+    void setTimeScale(int scale) { timeScale = min(max(scale, MIN_SCALE), MAX_SCALE); }
+};
+
+SimulationClock simClock;
+
+// Runs the due steps. A positive budget (seconds of wall time) drops the
+// steps that do not fit, so an overloaded window slows the simulation down
+// instead of freezing; each step that does run is unchanged.
+void runSimulation(long long due, double budget) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    for(long long i = 0; i < due; i++) {
+        scene->updateAll();
+        simClock.stepDone();
+        if(budget > 0.0 && (i & 63) == 63
+           && chrono::duration<double>(Clock::now() - start).count() > budget) {
+            break;
+        }
+    }
+    scene->interpolate(simClock.getAlpha());
+}
+
+
+// Layer slots for the cached static background, one per sky state
+enum BackgroundSlot { BACKGROUND_DAY, BACKGROUND_NIGHT };
+
+// Everything that only changes with day/night: sky and ground
+void drawStaticLayers(RenderBackend& backend) {
+    // Sky color based on day/night
+    if(isDay) {
+        backend.beginFrame(Color(0.53f, 0.81f, 0.92f));  // Day sky
+    } else {
+        backend.beginFrame(Color(0.04f, 0.04f, 0.12f));  // Night sky
+    }
+    
+    // Ground
+    Color ground = isDay ? Color(0.13f, 0.55f, 0.13f)    // Green ground
+                         : Color(0.08f, 0.23f, 0.08f);   // Dark green ground
+    ColorVertex quad[6] = {
+        {-500, -350, ground.r, ground.g, ground.b},
+        { 500, -350, ground.r, ground.g, ground.b},
+        { 500, -150, ground.r, ground.g, ground.b},
+        {-500, -350, ground.r, ground.g, ground.b},
+        { 500, -150, ground.r, ground.g, ground.b},
+        {-500, -150, ground.r, ground.g, ground.b}
+    };
+    backend.drawArrays(GL_TRIANGLES, quad, 6, 1.0f);
+}
+
+// Starts the frame from the cached static layers, rendering them on first use
+void drawBackground(RenderBackend& backend) {
+    int slot = isDay ? BACKGROUND_DAY : BACKGROUND_NIGHT;
+    if(!backend.hasLayer(slot) && backend.beginLayer(slot)) {
+        drawStaticLayers(backend);
+        backend.endFrame();
+        backend.endLayer();
+    }
+    
+    if(backend.hasLayer(slot)) {
+        backend.beginFrameFromLayer(slot);
+    } else {
+        drawStaticLayers(backend);  // No layer support: draw them every frame
+    }
+}
+
+// Copy the CPU-rendered frame into the GL back buffer
+void presentSoftwareFrame(const SoftwareRasterizer& raster) {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    glRasterPos2f(-1.0f, -1.0f);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glDrawPixels(raster.getWidth(), raster.getHeight(), GL_RGBA, GL_UNSIGNED_BYTE, raster.getPixels());
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+/**
+ * @class RetainedFrame
+ * @brief Offscreen colour buffer that keeps the finished frame between displays
+ *
+ * The window's back buffer is undefined after a swap, so partial redraws
+ * cannot go there. In a window they go into this framebuffer object
+ * instead, and the whole frame is blitted to the back buffer before the swap.
+ */
+class RetainedFrame {
+private:
+    GLuint framebuffer, colorBuffer;
+    int width, height;
+    bool failed;
+    
+public:
+    RetainedFrame() : framebuffer(0), colorBuffer(0), width(0), height(0), failed(false) {}
+    
+    // Binds for drawing. False means draw straight to the back buffer.
+    // allocated is set when the contents are new and undefined.
+    bool bind(int w, int h, bool& allocated) {
+        allocated = false;
+        if(failed || !glExt.hasFramebuffers()) return false;
+        
+        if(!framebuffer) {
+            glExt.genFramebuffers(1, &framebuffer);
+            glExt.genRenderbuffers(1, &colorBuffer);
+        }
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        
+        if(w != width || h != height) {
+            glExt.bindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+            glExt.renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+            glExt.bindRenderbuffer(GL_RENDERBUFFER, 0);
+            glExt.framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          GL_RENDERBUFFER, colorBuffer);
+            if(glExt.checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                cerr << "Offscreen framebuffer incomplete; redrawing every frame in full" << endl;
+                glExt.bindFramebuffer(GL_FRAMEBUFFER, 0);
+                failed = true;
+                return false;
+            }
+            width = w;
+            height = h;
+            allocated = true;
+        }
+        return true;
+    }
+    
+    // Copies the frame to the window's back buffer and leaves that bound
+    void present() {
+        glExt.bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glExt.bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glExt.blitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+RetainedFrame retainedFrame;
+
+
+/**
+ * @struct TexVertex
+ * @brief Position and texture coordinate of a textured quad corner
+ */
+struct TexVertex {
+    float x, y;
+    float u, v;
 };
 
 
 /**
- * @class CelestialBody
- * @brief Sun or Moon with animation
+ * @class GlyphAtlas
+ * @brief The GLUT bitmap fonts rasterised once into a single alpha texture
+ *
+ * GLUT draws bitmap text one glBitmap per character. Instead each printable
+ * glyph of the HUD fonts is drawn once into the back buffer, read back and
+ * kept as a texture, so text becomes ordinary textured quads.
  */
-class CelestialBody : public Drawable {
+class GlyphAtlas {
+public:
+    static const int FIRST_CHAR = 32;
+    static const int CHAR_COUNT = 95;
+    static const int PAD = 2;
+    
+    struct Font {
+        void* glutFont;
+        int cellWidth, cellHeight;
+        int descent;              // Baseline height inside the cell
+        int originY;              // First row of this font in the atlas
+        int advance[CHAR_COUNT];
+    };
+    
 private:
-    float radius;
-    float angle;
-    Color color;
+    vector<Font> fonts;
+    GLuint texture;
+    int width, height;
+    bool built;
     
 public:
-    CelestialBody(float posX, float posY, float rad, Color col)
-        : Drawable(posX, posY), radius(rad), angle(0), color(col) {}
+    GlyphAtlas() : texture(0), width(512), height(0), built(false) {
+        void* used[] = {GLUT_BITMAP_HELVETICA_18, GLUT_BITMAP_HELVETICA_12, GLUT_BITMAP_8_BY_13};
+        for(void* f : used) {
+            Font font;
+            font.glutFont = f;
+            fonts.push_back(font);
+        }
+    }
+    
+    bool isBuilt() const { return built; }
+    GLuint getTexture() const { return texture; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
     
-    void draw() override {
-        if(!visible) return;
+    const Font* find(void* glutFont) const {
+        for(const Font& f : fonts) {
+            if(f.glutFont == glutFont) return &f;
+        }
+        return nullptr;
+    }
+    
+    // Must run before the frame is drawn: it uses the back buffer as scratch
+    bool build() {
+        int y = 0;
+        for(Font& f : fonts) {
+            int maxAdvance = 0;
+            for(int i = 0; i < CHAR_COUNT; i++) {
+                f.advance[i] = glutBitmapWidth(f.glutFont, FIRST_CHAR + i);
+                maxAdvance = max(maxAdvance, f.advance[i]);
+            }
+            int lineHeight = glutBitmapHeight(f.glutFont);
+            f.cellWidth = maxAdvance + 2 * PAD;
+            f.cellHeight = lineHeight + 2 * PAD;
+            f.descent = (lineHeight + 3) / 4;
+            f.originY = y;
+            
+            int perRow = width / f.cellWidth;
+            y += ((CHAR_COUNT + perRow - 1) / perRow) * f.cellHeight;
+        }
+        height = 1;
+        while(height < y) height *= 2;
         
-        glColor3f(color.r, color.g, color.b);
+        if(viewportWidth < width || viewportHeight < height) return false;
         
-        // Draw rays
-        if(isDay) {
-            for(int i = 0; i < 12; i++) {
-                float rayAngle = (360.0f / 12.0f) * i * 3.14159f / 180.0f;
-                float x1 = x + (radius + 5) * cos(rayAngle);
-                float y1 = y + (radius + 5) * sin(rayAngle);
-                float x2 = x + (radius + 15) * cos(rayAngle);
-                float y2 = y + (radius + 15) * sin(rayAngle);
-                
-                glBegin(GL_LINES);
-                glVertex2f(x1, y1);
-                glVertex2f(x2, y2);
-                glEnd();
+        glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_VIEWPORT_BIT | GL_CURRENT_BIT);
+        glDisable(GL_BLEND);
+        glViewport(0, 0, width, height);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        gluOrtho2D(0, width, 0, height);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glColor3f(1.0f, 1.0f, 1.0f);
+        for(const Font& f : fonts) {
+            for(int i = 0; i < CHAR_COUNT; i++) {
+                int cx, cy;
+                cellOrigin(f, i, cx, cy);
+                glRasterPos2i(cx + PAD, cy + PAD + f.descent);
+                glutBitmapCharacter(f.glutFont, FIRST_CHAR + i);
             }
         }
         
-        // Draw body
-        drawCircle(x, y, radius);
+        vector<unsigned char> pixels(width * height);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+        
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glPopAttrib();
+        
+        if(!texture) glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0,
+                     GL_ALPHA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        built = true;
+        return true;
     }
     
-    void update() override {
-        if(isPaused || !animateCelestial) return;
-        
-        angle += 0.3f;
-        if(angle >= 360.0f) angle = 0.0f;
+    // Bottom-left corner of a glyph cell in atlas pixels
+    void cellOrigin(const Font& f, int index, int& cx, int& cy) const {
+        int perRow = width / f.cellWidth;
+        cx = (index % perRow) * f.cellWidth;
+        cy = f.originY + (index / perRow) * f.cellHeight;
     }
 };
 
+GlyphAtlas glyphAtlas;
+
 
 /**
- * @class Windmill
- * @brief Complete windmill with rotating blades
+ * @class TextLine
+ * @brief One line of HUD text with its quads laid out in world space
  */
-class Windmill : public Drawable {
+class TextLine {
 private:
-    // Private members 
-    float bladeAngle;
-    float rotationSpeed;
-    bool isRotating;
-    float towerWidth;
-    float towerHeight;
-    float bladeLength;
-    int numBlades;
-    int id;  
-    
-    // Static member 
-    static int windmillCount;
-    static const int SELECTED_NONE = -1;
+    void* font;
+    float x, y;          // Baseline start, world units
+    string text;
+    vector<TexVertex> quads;
+    float layoutScaleX, layoutScaleY;
+    bool damaged;        // Text changed since damage was last collected
     
 public:
-    static int selectedWindmill;  
+    TextLine(void* f, float posX, float posY)
+        : font(f), x(posX), y(posY), layoutScaleX(0), layoutScaleY(0), damaged(true) {}
     
-    // Constructor
-    Windmill(float posX, float posY, float tWidth = 30.0f, 
-             float tHeight = 120.0f, float bLength = 80.0f, int blades = 4)
-        : Drawable(posX, posY),
-          bladeAngle(0.0f),
-          rotationSpeed(2.0f),
-          isRotating(true),
-          towerWidth(tWidth),
-          towerHeight(tHeight),
-          bladeLength(bLength),
-          numBlades(blades) {
-        
-        windmillCount++;
-        id = windmillCount;
+    // Returns true when the text actually changed
+    bool setText(const string& t) {
+        if(t == text) return false;
+        text = t;
+        layoutScaleX = 0;
+        damaged = true;
+        return true;
     }
     
-    // Destructor
-    ~Windmill() {
-        windmillCount--;
-    }
+    const string& getText() const { return text; }
+    bool isDamaged() const { return damaged; }
     
-private:
-    void drawTower() {
-        // Tower color
-        glColor3f(0.55f, 0.27f, 0.07f);  // Brown
-        
-        // Tower trapezoid
-        glBegin(GL_POLYGON);
-        glVertex2f(x - towerWidth/2, y);
-        glVertex2f(x + towerWidth/2, y);
-        glVertex2f(x + towerWidth/3, y + towerHeight);
-        glVertex2f(x - towerWidth/3, y + towerHeight);
-        glEnd();
-        
-        // Door
-        glColor3f(0.3f, 0.15f, 0.05f);
-        glBegin(GL_POLYGON);
-        glVertex2f(x - 8, y);
-        glVertex2f(x + 8, y);
-        glVertex2f(x + 8, y + 30);
-        glVertex2f(x - 8, y + 30);
-        glEnd();
+    // Glyphs are pixel-sized; the band runs to the right edge so any old text is covered
+    void collectDamage(DamageRegion& region) {
+        if(!damaged) return;
+        float sx = WORLD_WIDTH / viewportWidth;
+        float sy = WORLD_HEIGHT / viewportHeight;
+        region.add(Rect(x - GlyphAtlas::PAD * sx, y - 8 * sy, WORLD_WIDTH / 2, y + 22 * sy));
+        damaged = false;
     }
     
-    void drawBlades() {
-        float centerX = x;
-        float centerY = y + towerHeight;
+    const vector<TexVertex>& layout(const GlyphAtlas& atlas) {
+        // Glyphs are pixel-sized, so the layout depends on the viewport
+        float sx = WORLD_WIDTH / viewportWidth;
+        float sy = WORLD_HEIGHT / viewportHeight;
+        if(sx == layoutScaleX && sy == layoutScaleY) return quads;
+        layoutScaleX = sx;
+        layoutScaleY = sy;
         
-        glPushMatrix();
-        glTranslatef(centerX, centerY, 0.0f);
-        glRotatef(bladeAngle, 0.0f, 0.0f, 1.0f);
+        quads.clear();
+        const GlyphAtlas::Font* f = atlas.find(font);
+        if(!f) return quads;
         
-        float angleStep = 360.0f / numBlades;
-        for(int i = 0; i < numBlades; i++) {
-            glPushMatrix();
-            glRotatef(i * angleStep, 0.0f, 0.0f, 1.0f);
-            
-            // Draw blade
-            glColor3f(0.95f, 0.95f, 0.90f);  // Off-white
-            glBegin(GL_POLYGON);
-            glVertex2f(0.0f, 0.0f);
-            glVertex2f(-5.0f, bladeLength * 0.3f);
-            glVertex2f(-3.0f, bladeLength);
-            glVertex2f(3.0f, bladeLength);
-            glVertex2f(5.0f, bladeLength * 0.3f);
-            glEnd();
+        float invW = 1.0f / atlas.getWidth();
+        float invH = 1.0f / atlas.getHeight();
+        float pen = x;
+        for(char c : text) {
+            int index = static_cast<unsigned char>(c) - GlyphAtlas::FIRST_CHAR;
+            if(index < 0 || index >= GlyphAtlas::CHAR_COUNT) continue;
             
-            // Blade outline
-            glColor3f(0.7f, 0.7f, 0.65f);
-            glBegin(GL_LINE_LOOP);
-            glVertex2f(0.0f, 0.0f);
-            glVertex2f(-5.0f, bladeLength * 0.3f);
-            glVertex2f(-3.0f, bladeLength);
-            glVertex2f(3.0f, bladeLength);
-            glVertex2f(5.0f, bladeLength * 0.3f);
-            glEnd();
+            int cx, cy;
+            atlas.cellOrigin(*f, index, cx, cy);
+            float x0 = pen - GlyphAtlas::PAD * sx;
+            float y0 = y - (GlyphAtlas::PAD + f->descent) * sy;
+            float x1 = x0 + f->cellWidth * sx;
+            float y1 = y0 + f->cellHeight * sy;
+            float u0 = cx * invW, v0 = cy * invH;
+            float u1 = (cx + f->cellWidth) * invW, v1 = (cy + f->cellHeight) * invH;
             
-            glPopMatrix();
+            quads.push_back({x0, y0, u0, v0});
+            quads.push_back({x1, y0, u1, v0});
+            quads.push_back({x1, y1, u1, v1});
+            quads.push_back({x0, y1, u0, v1});
+            pen += f->advance[index] * sx;
         }
-        
-        glPopMatrix();
-    }
-    
-    void drawHub() {
-        float centerX = x;
-        float centerY = y + towerHeight;
-        
-        // Hub circle
-        glColor3f(0.3f, 0.3f, 0.3f);
-        drawCircle(centerX, centerY, 15.0f);
-        
-        // Center bolt
-        glColor3f(0.2f, 0.2f, 0.2f);
-        drawCircle(centerX, centerY, 8.0f);
+        return quads;
     }
     
-    void drawSelectionIndicator() {
-        if(selectedWindmill == id) {
-            // Draw selection circle around windmill
-            glColor3f(1.0f, 1.0f, 0.0f);  // Yellow
-            glLineWidth(3.0f);
-            
-            float centerX = x;
-            float centerY = y + towerHeight;
-            
-            glBegin(GL_LINE_LOOP);
-            for(int i = 0; i < 50; i++) {
-                float angle = 2.0f * 3.14159f * float(i) / 50.0f;
-                float px = centerX + 100.0f * cos(angle);
-                float py = centerY + 100.0f * sin(angle);
-                glVertex2f(px, py);
-            }
-            glEnd();
-            
-            glLineWidth(1.0f);
+    // Plain GLUT path, used until the atlas exists
+    void drawBitmap() const {
+        glRasterPos2f(x, y);
+        for(char c : text) {
+            glutBitmapCharacter(font, c);
         }
     }
-    
-public:
-    void draw() override {
-        if(!visible) return;
-        
-        drawTower();
-        drawBlades();
-        drawHub();
-        drawSelectionIndicator();
-    }
-    
-    void update() override {
-        if(isPaused || !isRotating) return;
-        
-        bladeAngle += rotationSpeed;
-        if(bladeAngle >= 360.0f) bladeAngle -= 360.0f;
-    }
-    
-    // Control methods
-    void toggleRotation() { isRotating = !isRotating; }
-    void increaseSpeed() { 
-        rotationSpeed += 0.5f;
-        if(rotationSpeed > 15.0f) rotationSpeed = 15.0f;
-    }
-    void decreaseSpeed() { 
-        rotationSpeed -= 0.5f;
-        if(rotationSpeed < 0.5f) rotationSpeed = 0.5f;
-    }
-    
-    // Getters
-    bool getIsRotating() const { return isRotating; }
-    float getSpeed() const { return rotationSpeed; }
-    int getId() const { return id; }
-    
-    // Static member access
-    static int getCount() { return windmillCount; }
 };
 
 
-int Windmill::windmillCount = 0;
-int Windmill::selectedWindmill = 1;  // First windmill selected by default
-
 /**
- * @class Scene
- * @brief Manages all objects in the simulation
+ * @class HudText
+ * @brief HUD lines that are only re-formatted when their source values change
+ *
+ * All lines share the glyph atlas, so the whole HUD is one textured draw.
  */
-class Scene {
+class HudText {
 private:
-    vector<Drawable*> objects;  
-    vector<Windmill*> windmills;  // Separate windmill reference for control
-    vector<Cloud*> clouds;
-    CelestialBody* celestialBody;
+    enum { LINE_TITLE, LINE_MODE, LINE_SELECTION, LINE_FARM, LINE_STATS, LINE_CONTROLS, LINE_COUNT };
+    
+    vector<TextLine> lines;
+    vector<TexVertex> combined;
+    bool combinedDirty;
+    int combinedWidth, combinedHeight;
+    
+    // Last values the lines were built from
+    int shownDay, shownPaused, shownTimeScale;
+    int shownSelection;
+    float shownSpeed, shownWind, shownPower;
+    int shownRotating;
+    size_t shownFarmCount;
+    double shownFarmPower, shownFarmEnergy;
+    int shownDrawCalls, shownStateChanges;
     
 public:
-    Scene() {
-        celestialBody = nullptr;
+    HudText()
+        : combinedDirty(true), combinedWidth(0), combinedHeight(0), shownDay(-1), shownPaused(-1),
+          shownTimeScale(-1),
+          shownSelection(-1), shownSpeed(-1.0f), shownWind(-1.0f), shownPower(-1.0f), shownRotating(-1),
+          shownFarmCount(SIZE_MAX), shownFarmPower(-1.0), shownFarmEnergy(-1.0),
+          shownDrawCalls(-1), shownStateChanges(-1) {
+        lines.push_back(TextLine(GLUT_BITMAP_HELVETICA_18, -480, 320));
+        lines.push_back(TextLine(GLUT_BITMAP_HELVETICA_12, -480, 295));
+        lines.push_back(TextLine(GLUT_BITMAP_HELVETICA_12, -480, 275));
+        lines.push_back(TextLine(GLUT_BITMAP_HELVETICA_12, -480, 255));
+        lines.push_back(TextLine(GLUT_BITMAP_HELVETICA_12, -480, 235));
+        lines.push_back(TextLine(GLUT_BITMAP_8_BY_13, -480, -320));
+        
+        lines[LINE_TITLE].setText("Enhanced Windmill Simulation - OOP Project");
+        lines[LINE_CONTROLS].setText("Controls: 1-5-Select | +/-Speed | D-Day | N-Night | C-Cloud | W-Windmill | X-Remove | S-Sun | P-Pause | [/]-Time | O/L-Save/Load | R-Reset | Q-Quit");
     }
     
-    ~Scene() {
-        // Clean up all dynamically allocated objects
-        for(auto obj : objects) {
-            delete obj;
-        }
-        objects.clear();
-        windmills.clear();
-        clouds.clear();
+    void setMode(bool day, bool paused, int timeScale) {
+        if(day == shownDay && paused == shownPaused && timeScale == shownTimeScale) return;
+        shownDay = day;
+        shownPaused = paused;
+        shownTimeScale = timeScale;
+        
+        string mode = "Mode: ";
+        mode += day ? "DAY" : "NIGHT";
+        mode += paused ? " (PAUSED)" : "";
+        mode += " | Time x" + to_string(timeScale);
+        combinedDirty |= lines[LINE_MODE].setText(mode);
     }
     
-    void addWindmill(Windmill* w) {
-        windmills.push_back(w);
-        objects.push_back(w);
+    // selection <= 0 hides the line
+    void setSelection(int selection, float speed, float wind, float power, bool rotating) {
+        if(selection == shownSelection && speed == shownSpeed && wind == shownWind &&
+           power == shownPower && rotating == shownRotating) return;
+        shownSelection = selection;
+        shownSpeed = speed;
+        shownWind = wind;
+        shownPower = power;
+        shownRotating = rotating;
+        
+        if(selection <= 0) {
+            combinedDirty |= lines[LINE_SELECTION].setText("");
+            return;
+        }
+        char info[120];
+        snprintf(info, sizeof(info), "Windmill #%d: Speed = %.1f rpm | Wind = %.1f m/s | Power = %.2f MW | Status = %s",
+                 selection, speed, wind, power / 1e6f, rotating ? "ROTATING" : "STOPPED");
+        combinedDirty |= lines[LINE_SELECTION].setText(info);
     }
     
-    void addCloud(Cloud* c) {
-        clouds.push_back(c);
-        objects.push_back(c);
+    // Power in W, energy in J
+    void setFarm(size_t windmills, double power, double energy) {
+        // The count changes while paused, when power and energy stand still
+        if(windmills == shownFarmCount && power == shownFarmPower && energy == shownFarmEnergy) return;
+        shownFarmCount = windmills;
+        shownFarmPower = power;
+        shownFarmEnergy = energy;
+        
+        char info[100];
+        snprintf(info, sizeof(info), "Farm: %zu windmills | Power = %.2f MW | Energy = %.3f MWh",
+                 windmills, power / 1e6, energy / 3.6e9);
+        combinedDirty |= lines[LINE_FARM].setText(info);
     }
     
-    void setCelestialBody(CelestialBody* cb) {
-        celestialBody = cb;
-        objects.push_back(cb);
+    void setRenderStats(const RenderStats& stats) {
+        if(stats.drawCalls == shownDrawCalls && stats.stateChanges == shownStateChanges) return;
+        shownDrawCalls = stats.drawCalls;
+        shownStateChanges = stats.stateChanges;
+        
+        char info[100];
+        snprintf(info, sizeof(info), "Draw calls: %d | State changes: %d",
+                 stats.drawCalls, stats.stateChanges);
+        combinedDirty |= lines[LINE_STATS].setText(info);
     }
     
-    void drawAll() {
-        for(auto obj : objects) {
-            obj->draw();
-        }
+    void collectDamage(DamageRegion& region) {
+        for(TextLine& line : lines) line.collectDamage(region);
     }
     
-    void updateAll() {
-        for(auto obj : objects) {
-            obj->update();
+    bool hasDamage() const {
+        for(const TextLine& line : lines) {
+            if(line.isDamaged()) return true;
         }
+        return false;
     }
     
-    vector<Windmill*>& getWindmills() { return windmills; }
-    vector<Cloud*>& getClouds() { return clouds; }
-    
-    void clear() {
-        for(auto obj : objects) {
-            delete obj;
+    void draw() {
+        glColor3f(1.0f, 1.0f, 1.0f);
+        
+        if(!glyphAtlas.isBuilt()) {
+            // GLUT fonts need an initialised GLUT, which headless runs lack
+            if(!headlessMode) {
+                for(const TextLine& line : lines) line.drawBitmap();
+            }
+            return;
+        }
+        
+        // Glyph quads are pixel-sized, so a resize also forces a relayout
+        if(viewportWidth != combinedWidth || viewportHeight != combinedHeight) {
+            combinedWidth = viewportWidth;
+            combinedHeight = viewportHeight;
+            combinedDirty = true;
+        }
+        if(combinedDirty) {
+            combined.clear();
+            for(TextLine& line : lines) {
+                const vector<TexVertex>& q = line.layout(glyphAtlas);
+                combined.insert(combined.end(), q.begin(), q.end());
+            }
+            combinedDirty = false;
         }
-        objects.clear();
-        windmills.clear();
-        clouds.clear();
-        celestialBody = nullptr;
+        if(combined.empty()) return;
+        
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, glyphAtlas.getTexture());
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(TexVertex), &combined[0].x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(TexVertex), &combined[0].u);
+        glDrawArrays(GL_QUADS, 0, static_cast<GLsizei>(combined.size()));
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
     }
 };
 
+HudText hudText;
 
-Scene* scene = nullptr;
-
+// Counters for the last displayed frame, summed over its redraw passes
+RenderStats frameStats;
 
-void drawBackground() {
-    // Sky color based on day/night
-    if(isDay) {
-        glClearColor(0.53f, 0.81f, 0.92f, 1.0f);  // Day sky
-    } else {
-        glClearColor(0.04f, 0.04f, 0.12f, 1.0f);  // Night sky
-    }
+// Feeds the HUD its source values; lines only change when a value does
+void updateHUD() {
+    hudText.setMode(isDay, isPaused, simClock.getTimeScale());
     
-    glClear(GL_COLOR_BUFFER_BIT);
-    
-    // Ground
-    if(isDay) {
-        glColor3f(0.13f, 0.55f, 0.13f);  // Green ground
+    // Selected windmill info
+    if(scene->hasSelection()) {
+        Windmill selected = scene->getSelected();
+        hudText.setSelection(scene->getSelectedWindmill(), selected.getSpeed(), selected.getWind(),
+                             selected.getPower(), selected.getIsRotating());
     } else {
-        glColor3f(0.08f, 0.23f, 0.08f);  // Dark green ground
+        hudText.setSelection(0, 0.0f, 0.0f, 0.0f, false);
     }
-    
-    glBegin(GL_POLYGON);
-    glVertex2f(-500, -350);
-    glVertex2f(500, -350);
-    glVertex2f(500, -150);
-    glVertex2f(-500, -150);
-    glEnd();
+    hudText.setFarm(scene->getWindmillCount() + scene->getCompactCount(), scene->getFarmPower(),
+                    scene->getFarmEnergy());
+    hudText.setRenderStats(frameStats);
 }
 
 void drawHUD() {
-    glColor3f(1.0f, 1.0f, 1.0f);
+    hudText.draw();
+}
+
+
+void display() {
+    // First frame only; borrows the back buffer before anything is drawn
+    if(!glyphAtlas.isBuilt() && !headlessMode) glyphAtlas.build();
     
-    // Draw text information
-    glRasterPos2f(-480, 320);
-    string title = "Enhanced Windmill Simulation - OOP Project";
-    for(char c : title) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+    // Partial redraws need a framebuffer that survives presenting. The CPU
+    // framebuffer and the never-swapped headless pbuffer already do.
+    RenderBackend& backend = activeBackend();
+    bool retained = !backend.usesOpenGL() || headlessMode;
+    if(!retained) {
+        bool allocated;
+        retained = retainedFrame.bind(viewportWidth, viewportHeight, allocated);
+        if(allocated) damage.markFull();
     }
+    if(!retained) damage.markFull();
     
-    // Mode
-    glRasterPos2f(-480, 295);
-    string mode = "Mode: ";
-    mode += isDay ? "DAY" : "NIGHT";
-    mode += isPaused ? " (PAUSED)" : "";
-    for(char c : mode) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-    }
+    updateHUD();
+    if(scene) scene->collectDamage(damage);
+    hudText.collectDamage(damage);
     
-    // Selected windmill info
-    if(!scene->getWindmills().empty() && Windmill::selectedWindmill > 0 
-       && Windmill::selectedWindmill <= scene->getWindmills().size()) {
-        Windmill* selected = scene->getWindmills()[Windmill::selectedWindmill - 1];
-        
-        glRasterPos2f(-480, 275);
-        char info[100];
-        sprintf(info, "Windmill #%d: Speed = %.1f | Status = %s", 
-                Windmill::selectedWindmill, 
-                selected->getSpeed(),
-                selected->getIsRotating() ? "ROTATING" : "STOPPED");
-        for(int i = 0; info[i] != '\0'; i++) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, info[i]);
+    // One scissored pass per damaged rectangle, drawing only what reaches into it
+    frameStats = RenderStats();
+    for(const PixelRect& clip : damage.toPixels(viewportWidth, viewportHeight)) {
+        backend.setClip(clip);
+        drawBackground(backend);
+        if(scene) {
+            scene->drawAll(backend, DamageRegion::toWorld(clip, viewportWidth, viewportHeight));
+            frameStats.add(scene->getRenderStats());
         }
+        backend.endFrame();
+        if(backend.usesOpenGL()) drawHUD();
+        frameStats.passes++;
     }
+    backend.clearClip();
+    damage.clear();
     
-    // Controls
-    int yPos = -320;
-    glRasterPos2f(-480, yPos);
-    string controls = "Controls: 1/2/3-Select | +/-Speed | D-Day | N-Night | C-Cloud | W-Windmill | S-Sun | P-Pause | R-Reset | Q-Quit";
-    for(char c : controls) {
-        glutBitmapCharacter(GLUT_BITMAP_8_BY_13, c);
-    }
-}
-
-
-void display() {
-    drawBackground();
+    // A headless CPU run has no GL context at all
+    if(headlessMode && softwareRenderer) return;
     
-    if(scene) {
-        scene->drawAll();
+    if(softwareRenderer) {
+        presentSoftwareFrame(*softwareRenderer);
+        drawHUD();
+    } else if(!headlessMode && retained) {
+        retainedFrame.present();
     }
     
-    drawHUD();
-    
-    glutSwapBuffers();
+    if(headlessMode) {
+        glFinish();  // Frame timings should include the rendering itself
+    } else {
+        glutSwapBuffers();
+    }
 }
 
 void timer(int value) {
+    typedef chrono::steady_clock Clock;
+    static Clock::time_point lastTick = Clock::now();
+    Clock::time_point now = Clock::now();
+    double elapsed = chrono::duration<double>(now - lastTick).count();
+    lastTick = now;
+    
     if(scene) {
-        scene->updateAll();
+        // Paused time is not owed; leave room in the tick for drawing
+        if(!isPaused) runSimulation(simClock.advance(elapsed), 0.010);
+        updateHUD();
+        
+        // A paused or static scene stops drawing altogether
+        if(!damage.isEmpty() || scene->hasDamage() || hudText.hasDamage()) {
+            glutPostRedisplay();
+        }
     }
     
-    glutPostRedisplay();
     glutTimerFunc(16, timer, 0);  // ~60 FPS
 }
 
+// Replaces the scene with a snapshot and reports how long that took
+bool loadScene(const string& path) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    if(!scene->load(path)) return false;
+    double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+    randomSeed = scene->getSeed();   // The run continues the snapshot's
+    printf("Loaded %s: %zu windmills, %zu clouds in %.2f ms\n", path.c_str(),
+           scene->getWindmillCount() + scene->getCompactCount(), scene->getCloudCount(), ms);
+    return true;
+}
+
+bool saveScene(const string& path) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    if(!scene->save(path)) {
+        cerr << "Could not write " << path << endl;
+        return false;
+    }
+    double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+    printf("Saved %s in %.2f ms\n", path.c_str(), ms);
+    return true;
+}
+
 void keyboard(unsigned char key, int x, int y) {
     switch(key) {
         case '1':
@@ -556,8 +6098,7 @@ void keyboard(unsigned char key, int x, int y) {
         case '5':
             {
                 int selection = key - '0';
-                if(selection > 0 && selection <= scene->getWindmills().size()) {
-                    Windmill::selectedWindmill = selection;
+                if(scene->selectWindmill(selection)) {
                     cout << "Selected Windmill #" << selection << endl;
                 }
             }
@@ -565,21 +6106,19 @@ void keyboard(unsigned char key, int x, int y) {
             
         case '+':
         case '=':
-            if(!scene->getWindmills().empty() && Windmill::selectedWindmill > 0 
-               && Windmill::selectedWindmill <= scene->getWindmills().size()) {
-                scene->getWindmills()[Windmill::selectedWindmill - 1]->increaseSpeed();
-                cout << "Speed increased to: " 
-                     << scene->getWindmills()[Windmill::selectedWindmill - 1]->getSpeed() << endl;
+            if(scene->hasSelection()) {
+                scene->getSelected().increaseSpeed();
+                cout << "Rated speed increased to: " 
+                     << scene->getSelected().getRatedSpeed() << " rpm" << endl;
             }
             break;
             
         case '-':
         case '_':
-            if(!scene->getWindmills().empty() && Windmill::selectedWindmill > 0 
-               && Windmill::selectedWindmill <= scene->getWindmills().size()) {
-                scene->getWindmills()[Windmill::selectedWindmill - 1]->decreaseSpeed();
-                cout << "Speed decreased to: " 
-                     << scene->getWindmills()[Windmill::selectedWindmill - 1]->getSpeed() << endl;
+            if(scene->hasSelection()) {
+                scene->getSelected().decreaseSpeed();
+                cout << "Rated speed decreased to: " 
+                     << scene->getSelected().getRatedSpeed() << " rpm" << endl;
             }
             break;
             
@@ -597,22 +6136,24 @@ void keyboard(unsigned char key, int x, int y) {
             
         case 'c':
         case 'C':
-            {
-                float cloudX = randomFloat(-450.0f, 450.0f);
-                float cloudY = randomFloat(150.0f, 280.0f);
-                float cloudSpeed = randomFloat(0.2f, 0.5f);
-                scene->addCloud(new Cloud(cloudX, cloudY, cloudSpeed));
-                cout << "Added new cloud" << endl;
-            }
+            scene->addRandomClouds(1);
+            cout << "Added new cloud" << endl;
             break;
             
         case 'w':
         case 'W':
             {
-                float windmillX = randomFloat(-400.0f, 400.0f);
-                float windmillY = randomFloat(-300.0f, -180.0f);
-                scene->addWindmill(new Windmill(windmillX, windmillY));
-                cout << "Added Windmill #" << Windmill::getCount() << endl;
+                EntityHandle added = scene->addRandomWindmills(1);
+                cout << "Added Windmill #" << added.index + 1 << endl;
+            }
+            break;
+            
+        case 'x':
+        case 'X':
+            if(scene->hasSelection()) {
+                int removed = scene->getSelectedWindmill();
+                scene->removeWindmill(scene->getSelected().getHandle());
+                cout << "Removed Windmill #" << removed << endl;
             }
             break;
             
@@ -628,11 +6169,27 @@ void keyboard(unsigned char key, int x, int y) {
             cout << "Simulation: " << (isPaused ? "PAUSED" : "RESUMED") << endl;
             break;
             
+        case '[':
+        case ']':
+            simClock.setTimeScale(key == ']' ? simClock.getTimeScale() * 10
+                                             : simClock.getTimeScale() / 10);
+            cout << "Time scale: x" << simClock.getTimeScale() << endl;
+            break;
+            
+        case 'o':
+        case 'O':
+            saveScene(snapshotPath);
+            break;
+            
+        case 'l':
+        case 'L':
+            loadScene(snapshotPath);
+            break;
+            
         case 'r':
         case 'R':
             cout << "Resetting simulation..." << endl;
             scene->clear();
-            Windmill::selectedWindmill = 1;
             // Re-initialize will be done by init() function
             break;
             
@@ -645,11 +6202,27 @@ void keyboard(unsigned char key, int x, int y) {
             break;
     }
     
+    // Keys can change selection, mode or the object list: redraw everything
+    damage.markFull();
     glutPostRedisplay();
 }
 
+// Size-dependent state that is not OpenGL: LOD, HUD layout, CPU framebuffer
+void setViewportSize(int width, int height) {
+    viewportWidth = width;
+    viewportHeight = height;
+    if(softwareRenderer) softwareRenderer->resize(width, height);
+    damage.markFull();
+    
+    // Round shapes pick their segment count from the on-screen size
+    CircleLibrary::setPixelScale(max(width / WORLD_WIDTH, height / WORLD_HEIGHT));
+    GeometryCache::refreshDetail();
+}
+
 void reshape(int width, int height) {
     glViewport(0, 0, width, height);
+    setViewportSize(width, height);
+    
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluOrtho2D(-500, 500, -350, 350);
@@ -659,22 +6232,30 @@ void reshape(int width, int height) {
 
 
 void initScene() {
-    srand(time(NULL));
-    
     scene = new Scene();
     
     // Add windmills
-    scene->addWindmill(new Windmill(-250.0f, -200.0f, 30.0f, 120.0f, 80.0f, 4));
-    scene->addWindmill(new Windmill(100.0f, -220.0f, 35.0f, 130.0f, 90.0f, 4));
-    scene->addWindmill(new Windmill(350.0f, -210.0f, 28.0f, 110.0f, 75.0f, 4));
+    scene->addWindmill(-250.0f, -200.0f, 30.0f, 120.0f, 80.0f, 4);
+    scene->addWindmill(100.0f, -220.0f, 35.0f, 130.0f, 90.0f, 4);
+    scene->addWindmill(350.0f, -210.0f, 28.0f, 110.0f, 75.0f, 4);
     
     // Add clouds
-    scene->addCloud(new Cloud(-300.0f, 220.0f, 0.3f, 25.0f));
-    scene->addCloud(new Cloud(0.0f, 250.0f, 0.25f, 30.0f));
-    scene->addCloud(new Cloud(250.0f, 200.0f, 0.35f, 28.0f));
+    scene->addCloud(-300.0f, 220.0f, 0.3f, 25.0f);
+    scene->addCloud(0.0f, 250.0f, 0.25f, 30.0f);
+    scene->addCloud(250.0f, 200.0f, 0.35f, 28.0f);
     
     // Add sun/moon
-    scene->setCelestialBody(new CelestialBody(350.0f, 250.0f, 30.0f, Color(1.0f, 0.95f, 0.0f)));
+    scene->setCelestialBody(350.0f, 250.0f, 30.0f, Color(1.0f, 0.95f, 0.0f));
+}
+
+// Adds random windmills and clouds, as the W and C keys do, up to the given
+// counts; compact windmills count towards the windmills
+void growScene(int windmills, int clouds, bool compact) {
+    int existing = static_cast<int>(scene->getWindmillCount() + scene->getCompactCount());
+    if(windmills > existing) scene->addRandomWindmills(windmills - existing, compact);
+    if(clouds > static_cast<int>(scene->getCloudCount())) {
+        scene->addRandomClouds(clouds - scene->getCloudCount());
+    }
 }
 
 void init() {
@@ -694,7 +6275,518 @@ void init() {
 }
 
 
+/**
+ * @struct HeadlessOptions
+ * @brief Settings for an offscreen run, parsed from the command line
+ */
+struct HeadlessOptions {
+    int frames = 300;
+    int width = WINDOW_WIDTH;
+    int height = WINDOW_HEIGHT;
+    string outputDir;    // Frames are written here as PPM when set
+    bool softwareRaster = false;
+};
+
+/**
+ * @struct FleetOptions
+ * @brief Scene size from the command line; the defaults are the classic scene
+ */
+struct FleetOptions {
+    int windmills = 3;
+    int clouds = 3;
+    bool compact = false;   // Added windmills are compact ones
+    string load;            // Snapshot to start from instead of the classic scene
+    string save;            // Snapshot written at the end of a headless or batch run
+};
+
+// After initScene(): the snapshot from --load if there is one, then grown
+// to the requested counts
+bool prepareScene(const FleetOptions& fleet) {
+    if(!fleet.load.empty() && !loadScene(fleet.load)) return false;
+    growScene(fleet.windmills, fleet.clouds, fleet.compact);
+    return true;
+}
+
+
+#ifdef __linux__
+/**
+ * @class HeadlessContext
+ * @brief Offscreen OpenGL context on Mesa's surfaceless EGL platform
+ *
+ * Needs neither a display server nor a GPU: with no hardware driver Mesa
+ * falls back to its llvmpipe software rasteriser. Rendering goes to a
+ * pbuffer of the requested size.
+ */
+class HeadlessContext {
+private:
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+    
+public:
+    HeadlessContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE) {}
+    
+    ~HeadlessContext() {
+        if(display == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+        if(context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        eglTerminate(display);
+    }
+    
+    bool create(int width, int height) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if(!getPlatformDisplay) {
+            cerr << "EGL_EXT_platform_base is not available" << endl;
+            return false;
+        }
+        
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if(display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+            cerr << "Could not open the surfaceless EGL display" << endl;
+            display = EGL_NO_DISPLAY;
+            return false;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+        
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint count = 0;
+        if(!eglChooseConfig(display, configAttribs, &config, 1, &count) || count == 0) {
+            cerr << "No pbuffer-capable OpenGL config" << endl;
+            return false;
+        }
+        
+        const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+        if(surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT
+           || !eglMakeCurrent(display, surface, surface, context)) {
+            cerr << "Could not create the offscreen context (EGL error 0x"
+                 << hex << eglGetError() << dec << ")" << endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+GLProc eglProcAddress(const char* name) {
+    return reinterpret_cast<GLProc>(eglGetProcAddress(name));
+}
+#endif
+
+
+// Binary PPM from RGB rows stored bottom-up, as OpenGL returns them
+bool writePPM(const string& path, const unsigned char* rgb, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for(int row = height - 1; row >= 0; row--) {
+        fwrite(rgb + row * width * 3, 1, width * 3, file);
+    }
+    fclose(file);
+    return true;
+}
+
+// Save the frame just rendered by whichever backend is active
+bool writeFrame(const string& path, int width, int height) {
+    vector<unsigned char> rgb(width * height * 3);
+    if(softwareRenderer) {
+        const uint32_t* src = softwareRenderer->getPixels();
+        for(int i = 0; i < width * height; i++) {
+            rgb[3 * i] = src[i] & 0xFF;
+            rgb[3 * i + 1] = (src[i] >> 8) & 0xFF;
+            rgb[3 * i + 2] = (src[i] >> 16) & 0xFF;
+        }
+    } else {
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+    }
+    return writePPM(path, rgb.data(), width, height);
+}
+
+int runHeadless(const HeadlessOptions& options, const FleetOptions& fleet) {
+    headlessMode = true;
+    
+#ifdef __linux__
+    HeadlessContext context;
+#endif
+    if(options.softwareRaster) {
+        // The CPU rasteriser needs no OpenGL context at all
+        softwareRenderer = new SoftwareRasterizer(options.width, options.height);
+        cout << "Headless renderer: CPU rasterizer, " << jobs.size() << " threads" << endl;
+        setViewportSize(options.width, options.height);
+        initScene();
+        if(!prepareScene(fleet)) return 1;
+    } else {
+#ifdef __linux__
+        if(!context.create(options.width, options.height)) return 1;
+        
+        cout << "Headless renderer: " << glGetString(GL_RENDERER)
+             << " (" << glGetString(GL_VERSION) << ")" << endl;
+        
+        loadGLExtensions(eglProcAddress);
+        init();
+        if(!prepareScene(fleet)) return 1;
+        reshape(options.width, options.height);
+#else
+        cerr << "--headless with OpenGL is only supported on Linux (EGL); use --renderer cpu" << endl;
+        return 1;
+#endif
+    }
+    cout << "Random seed: " << randomSeed << endl;
+    long long resumed = scene->getSteps();   // Non-zero after --load
+    
+    typedef chrono::steady_clock Clock;
+    double totalMs = 0.0, minMs = 1e9, maxMs = 0.0;
+    long long drawCalls = 0;
+    int redrawn = 0;
+    
+    for(int frame = 0; frame < options.frames; frame++) {
+        // Every frame stands for one fixed step of real time, so runs are reproducible
+        runSimulation(simClock.advance(SimulationClock::STEP), 0.0);
+        
+        Clock::time_point start = Clock::now();
+        display();
+        double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+        
+        totalMs += ms;
+        minMs = min(minMs, ms);
+        maxMs = max(maxMs, ms);
+        drawCalls += frameStats.drawCalls;
+        if(frameStats.passes > 0) redrawn++;
+        
+        if(!options.outputDir.empty()) {
+            char name[32];
+            snprintf(name, sizeof(name), "/frame_%05d.ppm", frame);
+            if(!writeFrame(options.outputDir + name, options.width, options.height)) {
+                cerr << "Could not write " << options.outputDir + name << endl;
+                return 1;
+            }
+        }
+    }
+    
+    if(options.frames > 0) {
+        printf("Frames: %d at %dx%d\n", options.frames, options.width, options.height);
+        printf("Frame time: avg %.3f ms | min %.3f ms | max %.3f ms\n",
+               totalMs / options.frames, minMs, maxMs);
+        printf("Throughput: %.1f fps | %.1f draw calls/frame\n",
+               1000.0 * options.frames / totalMs, double(drawCalls) / options.frames);
+        printf("Redrawn: %d of %d frames (the rest had no damage)\n", redrawn, options.frames);
+        printf("Simulated: %lld steps, %.1f s at x%d\n", resumed + simClock.getSteps(),
+               simClock.getSimulatedSeconds() + resumed * SimulationClock::STEP, simClock.getTimeScale());
+        if(resumed) printf("Resumed at step %lld; this run: %lld steps\n", resumed, simClock.getSteps());
+    }
+    if(!fleet.save.empty() && !saveScene(fleet.save)) return 1;
+    
+    delete scene;
+    scene = nullptr;
+    delete softwareRenderer;
+    softwareRenderer = nullptr;
+    return 0;
+}
+
+
+// Steps the simulation as fast as possible with no window, context or rendering
+int runBatch(long long steps, const FleetOptions& fleet) {
+    initScene();
+    if(!prepareScene(fleet)) return 1;
+    
+    size_t windmills = scene->getWindmillCount();
+    size_t compacts = scene->getCompactCount();
+    size_t clouds = scene->getCloudCount();
+    cout << "Batch: " << steps << " steps, " << windmills + compacts << " windmills";
+    if(compacts) cout << " (" << compacts << " compact)";
+    cout << ", " << clouds << " clouds, " << simdKernels->name << " kernels, "
+         << jobs.size() << " threads (grain " << jobs.getGrain() << "), seed " << randomSeed << endl;
+    long long resumed = scene->getSteps();   // Non-zero after --load
+    
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    runSimulation(steps, 0.0);
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    
+    double simulated = simClock.getSimulatedSeconds() + resumed * SimulationClock::STEP;
+    printf("Wall time: %.3f s | %.0f steps/s | %.3g windmill-steps/s\n", seconds,
+           steps / seconds, double(steps) * (windmills + compacts) / seconds);
+    printf("Simulated: %.1f s (%.2f days, %.4f years)\n", simulated,
+           simulated / 86400.0, simulated / (365.25 * 86400.0));
+    if(resumed) printf("Resumed at step %lld; this run: %lld steps\n", resumed, steps);
+    
+    // Final state: a checksum over everything, then the first few objects
+    double angleSum = 0.0;
+    for(size_t i = 0; i < windmills; i++) angleSum += scene->getWindmill(i).getBladeAngle();
+    printf("Blade angle sum: %.6f\n", angleSum);
+    if(compacts) printf("Compact blade angle sum: %.6f\n", scene->getCompactAngleSum());
+    printf("Farm power: %.3f MW | energy %.3f MWh\n", scene->getFarmPower() / 1e6,
+           scene->getFarmEnergy() / 3.6e9);
+    printf("Wake links: %zu (%.2f per windmill)\n", scene->getWakeLinkCount(),
+           windmills ? double(scene->getWakeLinkCount()) / windmills : 0.0);
+    
+    const size_t SHOWN = 10;
+    for(size_t i = 0; i < windmills && i < SHOWN; i++) {
+        Windmill w = scene->getWindmill(i);
+        printf("  Windmill #%d: angle %.3f deg | %.2f rpm | pitch %.2f deg | wind %.2f m/s | "
+               "%.3f MW | %.3f MWh | %s\n", w.getId(), w.getBladeAngle(), w.getSpeed(), w.getPitch(),
+               w.getWind(), w.getPower() / 1e6, w.getEnergy() / 3.6e9,
+               w.getIsRotating() ? "rotating" : "stopped");
+    }
+    for(size_t i = 0; i < clouds && i < SHOWN; i++) {
+        Cloud c = scene->getCloud(i);
+        printf("  Cloud %zu: x %.3f | y %.3f\n", i + 1, c.getX(), c.getY());
+    }
+    if(windmills > SHOWN || clouds > SHOWN) {
+        printf("  (first %zu of each shown)\n", SHOWN);
+    }
+    if(!fleet.save.empty() && !saveScene(fleet.save)) return 1;
+    
+    delete scene;
+    scene = nullptr;
+    return 0;
+}
+
+
+// Runs every supported kernel variant against the scalar one on the same
+// random input, step by step, and requires bit-identical results
+int verifyKernels() {
+    // Odd length so every variant also runs its scalar tail
+    const size_t COUNT = 4099;
+    const int STEPS = 2000;
+    const float SPEEDS[] = {0.0f, 0.5f, 2.0f, 15.0f, 120.0f, 359.9f};
+    mt19937 rng(12345);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    
+    AlignedVector<float> angle(COUNT), speed(COUNT), spinning(COUNT);
+    AlignedVector<float> x(COUNT), cloudSpeed(COUNT);
+    AlignedVector<float> omega(COUNT), pitch(COUNT), wind(COUNT), radius(COUNT);
+    AlignedVector<float> inertia(COUNT), gain(COUNT), rated(COUNT);
+    AlignedVector<float> y(COUNT), drift(COUNT);
+    for(size_t i = 0; i < COUNT; i++) {
+        // Rotors from calm to storm, some spinning faster than rated and some at rest
+        radius[i] = 10.0f + unit(rng) * 60.0f;
+        inertia[i] = RotorModel::inertia(radius[i]);
+        gain[i] = RotorModel::instance().optimalGain(radius[i]);
+        rated[i] = RotorModel::RATED_TIP_SPEED / radius[i] * (0.5f + unit(rng));
+        wind[i] = (i % 17 == 0) ? 0.0f : unit(rng) * 30.0f;
+        omega[i] = (i % 19 == 0) ? 0.0f : unit(rng) * 2.0f * rated[i];
+        pitch[i] = unit(rng) * RotorModel::MAX_PITCH;
+        
+        // Start some rotors right at the wrap and some just below it
+        angle[i] = (i % 7 == 0) ? 360.0f - SPEEDS[i % 6] : unit(rng) * 360.0f;
+        speed[i] = (i % 3 == 0) ? SPEEDS[i % 6] : 0.5f + unit(rng) * 14.5f;
+        spinning[i] = (i % 5 == 0) ? 0.0f : 1.0f;
+        x[i] = (i % 11 == 0) ? CLOUD_EXIT_X - 0.25f : CLOUD_ENTRY_X + unit(rng) * 900.0f;
+        cloudSpeed[i] = (i % 13 == 0) ? 0.25f : 0.2f + unit(rng) * 0.3f;
+        
+        // Wind samples inside the grid, on its edges and beyond them
+        y[i] = (i % 23 == 0) ? WORLD_HEIGHT / 2 : (unit(rng) - 0.5f) * 1.2f * WORLD_HEIGHT;
+        drift[i] = unit(rng) * 0.05f;
+    }
+    
+    // Compact rotors at every speed code, some braked and some about to wrap
+    AlignedVector<uint16_t> phase(COUNT);
+    AlignedVector<uint8_t> code(COUNT), status(COUNT);
+    for(size_t i = 0; i < COUNT; i++) {
+        phase[i] = (i % 9 == 0) ? 65535 : static_cast<uint16_t>(rng());
+        code[i] = static_cast<uint8_t>(i);
+        status[i] = (i % 5 == 0) ? 0 : CompactRotor::SPINNING;
+    }
+    
+    // A random grid to sample, with the padding a real field has
+    const int GRID_COLUMNS = 126, GRID_ROWS = 89, GRID_STRIDE = 128;
+    AlignedVector<float> cells(GRID_STRIDE * GRID_ROWS);
+    for(float& c : cells) c = unit(rng) * 30.0f;
+    WindGrid grid = {cells.data(), GRID_COLUMNS, GRID_ROWS, GRID_STRIDE,
+                     -WORLD_WIDTH / 2, -WORLD_HEIGHT / 2, 1.0f / 8.0f};
+    
+    // Random wake links, some empty, some strong enough to hit the deficit cap
+    const size_t WAKE_STRIDE = (COUNT + 15) / 16 * 16;
+    AlignedVector<int> source(WAKE_SLOTS * WAKE_STRIDE);
+    AlignedVector<float> coupling(WAKE_SLOTS * WAKE_STRIDE), strength(COUNT);
+    for(size_t i = 0; i < source.size(); i++) {
+        source[i] = static_cast<int>(rng() % COUNT);
+        coupling[i] = (i % 3 == 0) ? 0.0f : unit(rng) * unit(rng);
+    }
+    for(float& t : strength) t = unit(rng) * 0.6f;
+    
+    const SimdKernels& reference = SIMD_VARIANTS[0];
+    int failures = 0;
+    for(int v = 1; v < SIMD_VARIANT_COUNT; v++) {
+        const SimdKernels& kernels = SIMD_VARIANTS[v];
+        if(!simdSupported(kernels)) {
+            printf("%-8s skipped (not supported by this CPU)\n", kernels.name);
+            continue;
+        }
+        
+        AlignedVector<float> a0 = angle, a1 = angle, p0(COUNT), p1(COUNT);
+        AlignedVector<float> x0 = x, x1 = x, q0(COUNT), q1(COUNT);
+        AlignedVector<unsigned char> w0(COUNT), w1(COUNT);
+        AlignedVector<float> o0 = omega, o1 = omega, b0 = pitch, b1 = pitch, d0(COUNT), d1(COUNT);
+        AlignedVector<float> g0(COUNT), g1(COUNT);
+        AlignedVector<double> e0(COUNT), e1(COUNT);
+        RotorColumns r0 = {o0.data(), b0.data(), d0.data(), g0.data(), e0.data(), wind.data(),
+                           radius.data(), inertia.data(), gain.data(), rated.data(), spinning.data()};
+        RotorColumns r1 = {o1.data(), b1.data(), d1.data(), g1.data(), e1.data(), wind.data(),
+                           radius.data(), inertia.data(), gain.data(), rated.data(), spinning.data()};
+        AlignedVector<float> n0(COUNT), n1(COUNT), s0(COUNT), s1(COUNT), u0(COUNT), u1(COUNT);
+        AlignedVector<float> z0(COUNT), z1(COUNT);
+        AlignedVector<uint16_t> h0 = phase, h1 = phase, k0(COUNT), k1(COUNT);
+        int windStep = -1, dynamicsStep = -1, rotorStep = -1, cloudStep = -1, randomStep = -1;
+        size_t wraps = 0;
+        for(int step = 0; step < STEPS; step++) {
+            // Noise rows crossing the lattice wrap; samples at the clouds, scaled every
+            // other step, then reduced by wakes
+            float u = step * 0.37f - 300.0f;
+            float t = step * 0.131f;
+            uint32_t seed = static_cast<uint32_t>(step) * 0x9e3779b9u;
+            reference.windNoise(n0.data(), u, step * 0.01f - 5.0f, 0.033f, t, seed, COUNT);
+            kernels.windNoise(n1.data(), u, step * 0.01f - 5.0f, 0.033f, t, seed, COUNT);
+            const float* scale = (step & 1) ? drift.data() : nullptr;
+            reference.sampleWind(grid, x0.data(), y.data(), scale, s0.data(), COUNT);
+            kernels.sampleWind(grid, x0.data(), y.data(), scale, s1.data(), COUNT);
+            reference.applyWake(s0.data(), strength.data(), source.data(), coupling.data(), WAKE_STRIDE, COUNT);
+            kernels.applyWake(s1.data(), strength.data(), source.data(), coupling.data(), WAKE_STRIDE, COUNT);
+            if(windStep < 0 && (memcmp(n0.data(), n1.data(), COUNT * sizeof(float)) != 0 ||
+                                memcmp(s0.data(), s1.data(), COUNT * sizeof(float)) != 0)) {
+                windStep = step;
+            }
+            
+            reference.integrateRotors(r0, COUNT);
+            kernels.integrateRotors(r1, COUNT);
+            if(dynamicsStep < 0 && (memcmp(o0.data(), o1.data(), COUNT * sizeof(float)) != 0 ||
+                                    memcmp(b0.data(), b1.data(), COUNT * sizeof(float)) != 0 ||
+                                    memcmp(d0.data(), d1.data(), COUNT * sizeof(float)) != 0 ||
+                                    memcmp(g0.data(), g1.data(), COUNT * sizeof(float)) != 0 ||
+                                    memcmp(e0.data(), e1.data(), COUNT * sizeof(double)) != 0)) {
+                dynamicsStep = step;
+            }
+            
+            reference.stepRotors(a0.data(), p0.data(), speed.data(), spinning.data(), COUNT);
+            kernels.stepRotors(a1.data(), p1.data(), speed.data(), spinning.data(), COUNT);
+            if(rotorStep < 0 && (memcmp(a0.data(), a1.data(), COUNT * sizeof(float)) != 0 ||
+                                 memcmp(p0.data(), p1.data(), COUNT * sizeof(float)) != 0)) {
+                rotorStep = step;
+            }
+            
+            reference.stepPhases(h0.data(), k0.data(), code.data(), status.data(), COUNT);
+            kernels.stepPhases(h1.data(), k1.data(), code.data(), status.data(), COUNT);
+            if(rotorStep < 0 && (memcmp(h0.data(), h1.data(), COUNT * sizeof(uint16_t)) != 0 ||
+                                 memcmp(k0.data(), k1.data(), COUNT * sizeof(uint16_t)) != 0)) {
+                rotorStep = step;
+            }
+            
+            size_t n0 = reference.stepClouds(x0.data(), q0.data(), cloudSpeed.data(), w0.data(), COUNT);
+            size_t n1 = kernels.stepClouds(x1.data(), q1.data(), cloudSpeed.data(), w1.data(), COUNT);
+            wraps += n0;
+            if(cloudStep < 0 && (n0 != n1 ||
+                                 memcmp(x0.data(), x1.data(), COUNT * sizeof(float)) != 0 ||
+                                 memcmp(q0.data(), q1.data(), COUNT * sizeof(float)) != 0 ||
+                                 memcmp(w0.data(), w1.data(), COUNT) != 0)) {
+                cloudStep = step;
+            }
+            
+            // Counters that run past 2^32 within one batch
+            uint32_t counter = 0xffffff00u + static_cast<uint32_t>(step) * 0x01000193u;
+            reference.randomUnit(u0.data(), seed, counter, COUNT);
+            kernels.randomUnit(u1.data(), seed, counter, COUNT);
+            reference.randomNormal(z0.data(), seed, counter, COUNT);
+            kernels.randomNormal(z1.data(), seed, counter, COUNT);
+            if(randomStep < 0 && (memcmp(u0.data(), u1.data(), COUNT * sizeof(float)) != 0 ||
+                                  memcmp(z0.data(), z1.data(), COUNT * sizeof(float)) != 0)) {
+                randomStep = step;
+            }
+        }
+        
+        if(windStep >= 0) printf("%-8s wind FAILED at step %d\n", kernels.name, windStep);
+        if(dynamicsStep >= 0) printf("%-8s dynamics FAILED at step %d\n", kernels.name, dynamicsStep);
+        if(rotorStep >= 0) printf("%-8s rotors FAILED at step %d\n", kernels.name, rotorStep);
+        if(cloudStep >= 0) printf("%-8s clouds FAILED at step %d\n", kernels.name, cloudStep);
+        if(randomStep >= 0) printf("%-8s random FAILED at step %d\n", kernels.name, randomStep);
+        if(windStep < 0 && dynamicsStep < 0 && rotorStep < 0 && cloudStep < 0 && randomStep < 0) {
+            printf("%-8s OK (%zu rotors and clouds x %d steps, %zu cloud wraps)\n",
+                   kernels.name, COUNT, STEPS, wraps);
+        } else {
+            failures++;
+        }
+    }
+    printf("Selected kernels: %s\n", simdKernels->name);
+    return failures == 0 ? 0 : 1;
+}
+
+
 int main(int argc, char** argv) {
+    // Command-line modes that run without a window
+    HeadlessOptions headless;
+    FleetOptions fleet;
+    bool runOffscreen = false;
+    long long batchSteps = -1;
+    bool verifyOnly = false;
+    int threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    long long grain = JobSystem::DEFAULT_GRAIN;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--headless") {
+            runOffscreen = true;
+        } else if(arg == "--frames" && i + 1 < argc) {
+            headless.frames = atoi(argv[++i]);
+        } else if(arg == "--size" && i + 1 < argc) {
+            if(sscanf(argv[++i], "%dx%d", &headless.width, &headless.height) != 2) {
+                cerr << "--size expects WIDTHxHEIGHT" << endl;
+                return 1;
+            }
+        } else if(arg == "--out" && i + 1 < argc) {
+            headless.outputDir = argv[++i];
+        } else if(arg == "--renderer" && i + 1 < argc) {
+            string name = argv[++i];
+            if(name != "cpu" && name != "gl") {
+                cerr << "--renderer expects cpu or gl" << endl;
+                return 1;
+            }
+            headless.softwareRaster = (name == "cpu");
+        } else if((arg == "--threads" || arg == "--sim-threads") && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if(arg == "--time-scale" && i + 1 < argc) {
+            simClock.setTimeScale(atoi(argv[++i]));
+        } else if(arg == "--simulate" && i + 1 < argc) {
+            batchSteps = max(0LL, atoll(argv[++i]));
+        } else if(arg == "--windmills" && i + 1 < argc) {
+            fleet.windmills = atoi(argv[++i]);
+        } else if(arg == "--clouds" && i + 1 < argc) {
+            fleet.clouds = atoi(argv[++i]);
+        } else if(arg == "--compact") {
+            fleet.compact = true;
+        } else if(arg == "--load" && i + 1 < argc) {
+            fleet.load = snapshotPath = argv[++i];
+        } else if(arg == "--save" && i + 1 < argc) {
+            fleet.save = snapshotPath = argv[++i];
+        } else if(arg == "--simd" && i + 1 < argc) {
+            const SimdKernels* chosen = findSimdKernels(argv[++i]);
+            if(!chosen) {
+                cerr << "--simd expects scalar, sse2, avx2 or avx512 supported by this CPU" << endl;
+                return 1;
+            }
+            simdKernels = chosen;
+        } else if(arg == "--verify-kernels") {
+            verifyOnly = true;
+        } else if(arg == "--wind" && i + 1 < argc) {
+            windSpeed = max(0.0f, static_cast<float>(atof(argv[++i])));
+        } else if(arg == "--grain" && i + 1 < argc) {
+            grain = max(1LL, atoll(argv[++i]));
+        } else if(arg == "--seed" && i + 1 < argc) {
+            randomSeed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+    }
+    jobs.configure(threads, static_cast<size_t>(grain));
+    if(verifyOnly) return verifyKernels();
+    if(batchSteps >= 0) return runBatch(batchSteps, fleet);
+    if(runOffscreen) return runHeadless(headless, fleet);
+    
     cout << "\n";
     cout << "╔═══════════════════════════════════════════════════════╗\n";
     cout << "║                                                       ║\n";
@@ -715,13 +6807,16 @@ int main(int argc, char** argv) {
     cout << "\n";
     
     cout << "Controls:\n";
-    cout << "  1/2/3     - Select windmill\n";
+    cout << "  1-5       - Select windmill\n";
     cout << "  +/-       - Adjust speed\n";
     cout << "  D/N       - Day/Night mode\n";
     cout << "  C         - Add cloud\n";
     cout << "  W         - Add windmill\n";
+    cout << "  X         - Remove selected windmill\n";
     cout << "  S         - Toggle sun animation\n";
     cout << "  P         - Pause/Resume\n";
+    cout << "  [/]       - Slower/faster time (x1 to x10000)\n";
+    cout << "  O/L       - Save/Load snapshot\n";
     cout << "  R         - Reset\n";
     cout << "  Q/ESC     - Exit\n";
     cout << "\n";
@@ -732,13 +6827,19 @@ int main(int argc, char** argv) {
     glutInitWindowPosition(100, 100);
     glutCreateWindow("Enhanced Windmill Simulation - OOP Project");
     
+    loadGLExtensions(glutGetProcAddress);
+    if(headless.softwareRaster) {
+        softwareRenderer = new SoftwareRasterizer(WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
     init();
+    if(!prepareScene(fleet)) return 1;
     
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
     glutTimerFunc(16, timer, 0);
     
+    cout << "Random seed: " << randomSeed << " (--seed " << randomSeed << " repeats this run)\n";
     cout << "Starting simulation...\n" << endl;
     
     glutMainLoop();